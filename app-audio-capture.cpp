@@ -1,10 +1,21 @@
+#include "application-manager.h"
 #include "audio-helpers.h"
 #include "audio-hook-info.h"
+#include "audio-kernels.h"
+#include "audio-transport.h"
+#include "capture-registry.h"
+#include "latency-trace.h"
 
+#include <algorithm>
+#include <atomic>
 #include <codecvt>
-#include <filesystem>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 #include <Windows.h>
 
@@ -23,6 +34,8 @@
 #define SETTING_TARGET_PROCESS          "target_application"
 #define SETTING_UPDATE_RATE             "update_rate"
 #define SETTING_BUFFER                  "buffer"
+#define SETTING_STATS                   "stats"
+#define SETTING_STATS_REFRESH           "stats_refresh"
 
 // ----------------------------------------------------------------------[ label
 
@@ -42,6 +55,10 @@
 #define LABEL_BUFFER_NORMAL             obs_module_text("AppAudioCapture.Buffer.Normal")
 #define LABEL_BUFFER_BIGGEST            obs_module_text("AppAudioCapture.Buffer.Biggest")
 
+#define LABEL_STATS                     obs_module_text("AppAudioCapture.Stats")
+#define LABEL_STATS_NONE                obs_module_text("AppAudioCapture.Stats.None")
+#define LABEL_STATS_REFRESH             obs_module_text("AppAudioCapture.Stats.Refresh")
+
 // --------------------------------------------------------------------[ tooltip
 
 #define TOOLTIP_UPDATE_RATE             obs_module_text("AppAudioCapture.UpdateRate.Tooltip")
@@ -61,98 +78,42 @@
 #define BUFFER_NORMAL                   480'000'000
 #define BUFFER_BIGGEST                  600'000'000
 
+// how often each source logs its streams' stats, in nanoseconds
+#define STATS_LOG_INTERVAL              60'000'000'000
+
+// "shm" to receive over shared memory rather than named pipes, read at module
+// load since every source shares the same receivers, see audio-transport.h
+#define TRANSPORT_ENV                   "OBS_APP_AUDIO_TRANSPORT"
+
+// path to record every received packet to, if set at module load
+#define RECORDING_ENV                   "OBS_APP_AUDIO_RECORD"
+
+// path to write a Chrome trace of every packet's latency to at module
+// unload, if set at module load
+#define TRACE_ENV                       "OBS_APP_AUDIO_TRACE"
+
 // clang-format on
 
 struct app_audio_capture_data {
     obs_source_t* source = nullptr;
 
-    uint32_t update_rate = 0;
-    uint32_t buffer = 0;
+    std::atomic<uint32_t> update_rate = 0;
+    std::atomic<uint32_t> buffer = 0;
     std::string target_session_name;
+    std::mutex settings_mutex;
 
+    // the capture thread sleeps on event until its next deadline, and gets
+    // woken early to stop or to pick up changed settings
     bool initialized_thread = false;
     pthread_t thread = {};
     os_event_t* event = nullptr;
+    std::atomic<bool> stopping = false;
+    std::atomic<bool> settings_changed = false;
 
-    application_manager app_manager;
-    audio_pipe_manager pipe_manager;
+    // fed by capture_registry, which is shared with every other source
     audio_mixer mixer;
-
-    app_audio_capture_data() { pipe_manager.set_mixer(mixer); }
 };
 
-bool check_file_integrity(std::string filepath)
-{
-    HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ | GENERIC_EXECUTE,
-        FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-
-    if (file != INVALID_HANDLE_VALUE) {
-        CloseHandle(file);
-        return true;
-    }
-
-    blog(LOG_WARNING, "obs-app-audio file \"%s\" couldn't be loaded: %lu",
-        filepath.c_str(), GetLastError());
-
-    return false;
-}
-
-bool create_dll_injector_proc(std::string dll_injector_path,
-    std::string dll_path, DWORD pid)
-{
-    PROCESS_INFORMATION pi = { 0 };
-    STARTUPINFOA si = { 0 };
-    si.cb = sizeof(si);
-
-    char command_line[MAX_PATH * 3] = { 0 };
-    snprintf(command_line, sizeof(command_line), "\"%s\" \"%s\" %lu",
-        dll_injector_path.c_str(), dll_path.c_str(), pid);
-
-    bool success = CreateProcessA(NULL, command_line, NULL, NULL, false,
-        CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
-
-    if (success) {
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
-    } else {
-        blog(LOG_WARNING, "Failed to create DLL injector process: %lu",
-            GetLastError());
-    }
-
-    return success;
-}
-
-inline std::string path_to_absolute(std::string_view path)
-{
-    return std::filesystem::absolute(path).string();
-}
-
-void inject_hooks(const std::unordered_map<DWORD, bool>& processes)
-{
-    auto injector_path_32 = path_to_absolute(obs_module_file("dll-injector32.exe"));
-    auto hook_path_32 = path_to_absolute(obs_module_file("audio-hook32.dll"));
-
-    if (!check_file_integrity(injector_path_32) || !check_file_integrity(hook_path_32))
-        return;
-
-#ifdef _WIN64
-    auto injector_path_64 = path_to_absolute(obs_module_file("dll-injector64.exe"));
-    auto hook_path_64 = path_to_absolute(obs_module_file("audio-hook64.dll"));
-
-    if (!check_file_integrity(injector_path_64) || !check_file_integrity(hook_path_64))
-        return;
-#endif
-
-    for (const auto& [pid, x64] : processes) {
-#ifdef _WIN64
-        if (x64)
-            create_dll_injector_proc(injector_path_64, hook_path_64, pid);
-        else
-#endif
-            create_dll_injector_proc(injector_path_32, hook_path_32, pid);
-    }
-}
-
 bool ensure_target_app_listed(obs_properties*, obs_property* list, obs_data* settings)
 {
     std::string name = obs_data_get_string(settings, SETTING_TARGET_PROCESS);
@@ -180,9 +141,9 @@ bool ensure_target_app_listed(obs_properties*, obs_property* list, obs_data* set
     return false;
 }
 
-bool fill_app_list(const application_manager& app_manager, obs_property* list)
+bool fill_app_list(obs_property* list)
 {
-    auto apps = app_manager.applications();
+    auto apps = capture_registry::get().applications();
     for (auto& [name, app] : apps) {
         std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
         auto display_name = converter.to_bytes(app.display_name());
@@ -195,55 +156,119 @@ bool fill_app_list(const application_manager& app_manager, obs_property* list)
 
 void update_apps_and_pipes(app_audio_capture_data* aacd)
 {
-    aacd->app_manager.refresh();
-
-    std::unordered_set<DWORD> pids;
-    if (aacd->app_manager.contains(aacd->target_session_name)) {
-        auto procs = aacd->app_manager.applications()
-                         .at(aacd->target_session_name)
-                         .processes();
-        for (auto& [pid, x64] : procs)
-            pids.insert(pid);
-        inject_hooks(procs);
+    std::string target_session_name;
+    {
+        std::lock_guard lock = std::lock_guard(aacd->settings_mutex);
+        target_session_name = aacd->target_session_name;
     }
-    aacd->pipe_manager.target(pids);
+
+    auto& registry = capture_registry::get();
+    registry.subscribe(&aacd->mixer, target_session_name);
+    registry.update(aacd->update_rate);
+}
+
+// Mixes straight into OBS's own output format, so that OBS doesn't resample
+// everything a second time. OBS can reset its audio while sources stay alive,
+// so this gets checked again on every update cycle.
+void sync_output_format(app_audio_capture_data* aacd)
+{
+    obs_audio_info info;
+    if (!obs_get_audio_info(&info))
+        return;
+
+    aacd->mixer.set_format((int)info.samples_per_sec, info.speakers);
 }
 
 void output_audio(app_audio_capture_data* aacd)
 {
-    uint64_t timestamp = aacd->mixer.timestamp();
-    std::vector<audio_frame> frames = aacd->mixer.pop();
+    audio_mixer::block_view view = aacd->mixer.pop();
+    if (!view.samples)
+        return;
 
     obs_source_audio audio;
-    audio.data[0] = (uint8_t*)frames.data();
-    audio.frames = (uint32_t)frames.size();
-    audio.samples_per_sec = AUDIO_RESAMPLE_SAMPLE_RATE;
+    audio.data[0] = (const uint8_t*)view.samples;
+    audio.frames = (uint32_t)view.size;
+    audio.samples_per_sec = view.sample_rate;
     audio.format = AUDIO_RESAMPLE_AUDIO_FORMAT;
-    audio.speakers = AUDIO_RESAMPLE_SPEAKERS;
-    audio.timestamp = timestamp;
+    audio.speakers = view.speakers;
+    audio.timestamp = view.timestamp;
 
     obs_source_output_audio(aacd->source, &audio);
+
+    if (view.traces_count) {
+        uint64_t now = os_gettime_ns();
+        for (size_t i = 0; i < view.traces_count; i++)
+            latency_tracer::get().record(trace_stage::output, view.traces[i], now);
+    }
+
+    aacd->mixer.release(view);
+}
+
+// One line per stream, the same for the properties and the log.
+std::string format_stats(const std::vector<audio_pipe_stats>& stats)
+{
+    std::string text;
+    for (auto& s : stats) {
+        char line[256];
+        snprintf(line, sizeof(line),
+            "pid %u: %llu packets, %llu bytes, %llu frames, %llu format changes, "
+            "%llu snapped, %llu unsnapped, %llu frames dropped, %llu frames rejected\n",
+            s.pid, (unsigned long long)s.packets, (unsigned long long)s.bytes,
+            (unsigned long long)s.frames, (unsigned long long)s.format_changes,
+            (unsigned long long)s.contiguous, (unsigned long long)s.discontiguous,
+            (unsigned long long)s.dropped_frames, (unsigned long long)s.rejected_frames);
+        text += line;
+    }
+    return text;
+}
+
+void log_stats(app_audio_capture_data* aacd)
+{
+    auto stats = capture_registry::get().stats(&aacd->mixer);
+    if (stats.empty())
+        return;
+
+    blog(LOG_INFO, "obs-app-audio stats for '%s':\n%s",
+        obs_source_get_name(aacd->source), format_stats(stats).c_str());
 }
 
 void* audio_capture_thread(void* data)
 {
     auto* aacd = (app_audio_capture_data*)data;
 
-    uint64_t last_update = os_gettime_ns();
-    uint64_t now = 0;
+    uint64_t next_update = os_gettime_ns();
+    uint64_t next_stats_log = next_update + STATS_LOG_INTERVAL;
 
-    while (os_event_try(aacd->event) == EAGAIN) {
-        now = os_gettime_ns();
+    while (!aacd->stopping) {
+        uint64_t now = os_gettime_ns();
 
         // update cycle (injecting dll and refreshing pipes)
-        if (now - last_update < aacd->update_rate) {
+        if (aacd->settings_changed.exchange(false) || now >= next_update) {
+            // the mixer's blocks belong to this thread, so it's the only
+            // one that gets to resize them
+            sync_output_format(aacd);
+            aacd->mixer.resize(aacd->mixer.calculate_size(aacd->buffer));
             update_apps_and_pipes(aacd);
-            last_update = os_gettime_ns();
+            next_update = os_gettime_ns() + aacd->update_rate;
+        }
+
+        if (now >= next_stats_log) {
+            log_stats(aacd);
+            next_stats_log = now + STATS_LOG_INTERVAL;
         }
 
         // obs audio output cycle
-        if (aacd->mixer.ready_to_pop())
+        while (aacd->mixer.ready_to_pop())
             output_audio(aacd);
+
+        // sleep until whichever comes first, rounding up so as to not wake
+        // just short of a deadline and spin
+        uint64_t deadline = std::min(next_update, aacd->mixer.pop_deadline());
+        now = os_gettime_ns();
+        if (deadline > now) {
+            unsigned long ms = (unsigned long)((deadline - now + 999'999) / 1'000'000);
+            os_event_timedwait(aacd->event, ms);
+        }
     }
     return NULL;
 }
@@ -262,10 +287,13 @@ void app_audio_capture_destroy(void* data)
         return;
 
     if (aacd->initialized_thread) {
+        aacd->stopping = true;
         os_event_signal(aacd->event);
         pthread_join(aacd->thread, NULL);
     }
 
+    capture_registry::get().unsubscribe(&aacd->mixer);
+
     os_event_destroy(aacd->event);
     delete aacd;
 }
@@ -284,9 +312,14 @@ void app_audio_capture_update(void* data, obs_data* settings)
 
     aacd->update_rate = (uint32_t)obs_data_get_int(settings, SETTING_UPDATE_RATE);
     aacd->buffer = (uint32_t)obs_data_get_int(settings, SETTING_BUFFER);
-    aacd->target_session_name = obs_data_get_string(settings, SETTING_TARGET_PROCESS);
+    {
+        std::lock_guard lock = std::lock_guard(aacd->settings_mutex);
+        aacd->target_session_name = obs_data_get_string(settings, SETTING_TARGET_PROCESS);
+    }
 
-    aacd->mixer.resize(audio_mixer::calculate_size(aacd->buffer));
+    aacd->settings_changed = true;
+    if (aacd->event)
+        os_event_signal(aacd->event);
 }
 
 void* app_audio_capture_create(obs_data* settings, obs_source* source)
@@ -294,9 +327,10 @@ void* app_audio_capture_create(obs_data* settings, obs_source* source)
     app_audio_capture_data* aacd = new app_audio_capture_data;
 
     aacd->source = source;
+    sync_output_format(aacd);
     app_audio_capture_update(aacd, settings);
 
-    if (os_event_init(&aacd->event, OS_EVENT_TYPE_MANUAL) != 0)
+    if (os_event_init(&aacd->event, OS_EVENT_TYPE_AUTO) != 0)
         goto fail;
     if (pthread_create(&aacd->thread, NULL, audio_capture_thread, aacd) != 0)
         goto fail;
@@ -310,6 +344,12 @@ fail:
     return NULL;
 }
 
+// Only there to have the properties built again with fresh stats.
+bool refresh_stats(obs_properties*, obs_property*, void*)
+{
+    return true;
+}
+
 obs_properties* app_audio_capture_properties(void* data)
 {
     auto* aacd = (app_audio_capture_data*)data;
@@ -320,7 +360,7 @@ obs_properties* app_audio_capture_properties(void* data)
         ppts, SETTING_TARGET_PROCESS, LABEL_TARGET_APPLICATION,
         OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
     obs_property_list_add_string(app_list, "", "");
-    fill_app_list(aacd->app_manager, app_list);
+    fill_app_list(app_list);
     obs_property_modified_t callback = ensure_target_app_listed;
 
     obs_property_set_modified_callback(app_list, callback);
@@ -343,6 +383,17 @@ obs_properties* app_audio_capture_properties(void* data)
     obs_property_list_add_int(buffer_list, LABEL_BUFFER_BIGGEST, BUFFER_BIGGEST);
     obs_property_set_long_description(buffer_list, TOOLTIP_BUFFER);
 
+    // a snapshot of whatever the source is capturing right now, there's no
+    // source to ask when OBS only wants the properties' layout
+    if (aacd) {
+        std::string stats = format_stats(capture_registry::get().stats(&aacd->mixer));
+        std::string text = std::string(LABEL_STATS) + "\n"
+            + (stats.empty() ? LABEL_STATS_NONE : stats);
+        obs_properties_add_text(ppts, SETTING_STATS, text.c_str(), OBS_TEXT_INFO);
+        obs_properties_add_button(ppts, SETTING_STATS_REFRESH, LABEL_STATS_REFRESH,
+            refresh_stats);
+    }
+
     return ppts;
 }
 
@@ -372,5 +423,53 @@ bool obs_module_load(void)
 
     obs_register_source(&app_audio_capture_info);
 
+    blog(LOG_INFO, "obs-app-audio mixing with %s kernel",
+        mix_samples_kernel_name());
+
+    set_transport_log([](const char* message) {
+        blog(LOG_WARNING, "obs-app-audio %s", message);
+    });
+
+    // before any source subscribes, so no pipe is ever opened on the wrong one
+    const char* transport = getenv(TRANSPORT_ENV);
+    if (transport && strcmp(transport, "shm") == 0) {
+        capture_registry::get().set_transport(audio_transport::shm);
+        blog(LOG_INFO, "obs-app-audio receiving over shared memory");
+    }
+
+    // for replaying with obs-app-audio-bench, see packet-recording.h
+    const char* recording = getenv(RECORDING_ENV);
+    if (recording && *recording) {
+        if (capture_registry::get().start_recording(recording))
+            blog(LOG_INFO, "obs-app-audio recording packets to %s", recording);
+        else
+            blog(LOG_WARNING, "obs-app-audio failed to record packets to %s",
+                recording);
+    }
+
+    // see latency-trace.h
+    const char* trace = getenv(TRACE_ENV);
+    if (trace && *trace) {
+        latency_tracer::get().start();
+        blog(LOG_INFO, "obs-app-audio tracing packet latency to %s", trace);
+    }
+
     return true;
 }
+
+void obs_module_unload(void)
+{
+    // before static destruction, which would otherwise end up joining the
+    // receiver threads from inside DllMain
+    capture_registry::get().stop_recording();
+    capture_registry::get().clear();
+
+    auto& tracer = latency_tracer::get();
+    const char* trace = getenv(TRACE_ENV);
+    if (tracer.tracing() && trace) {
+        tracer.stop();
+        if (!tracer.export_chrome_trace(trace))
+            blog(LOG_WARNING, "obs-app-audio failed to write trace to %s", trace);
+        blog(LOG_INFO, "obs-app-audio latency:\n%s", tracer.histogram().c_str());
+    }
+}
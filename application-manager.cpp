@@ -0,0 +1,181 @@
+#include "application-manager.h"
+
+#include <algorithm>
+
+// clang-format off
+
+// most refreshes to wait before describing a pid again, the wait doubles
+// from one refresh after every failure up to this
+#define MAX_DESCRIBE_BACKOFF            32
+
+// clang-format on
+
+//--------------------------------------------[ application_manager::application
+
+const std::unordered_map<uint32_t, bool>&
+application_manager::application::processes() const
+{
+    return m_processes;
+}
+
+const std::wstring& application_manager::application::display_name() const
+{
+    return m_display_name;
+}
+
+bool application_manager::application::contains(uint32_t pid) const
+{
+    return m_processes.find(pid) != m_processes.end();
+}
+
+//--------------------------------------------------[ application_manager::delta
+
+void application_manager::delta::clear()
+{
+    added.clear();
+    removed.clear();
+}
+
+//---------------------------------------------------------[ application_manager
+
+application_manager::application_manager(std::unique_ptr<session_backend> backend)
+    : m_backend(std::move(backend))
+{
+}
+
+void application_manager::set_backend(std::unique_ptr<session_backend> backend)
+{
+    m_backend = std::move(backend);
+    clear();
+}
+
+const std::unordered_map<std::string, application_manager::application>&
+application_manager::applications() const
+{
+    return m_applications;
+}
+
+void application_manager::add(const process& proc)
+{
+    auto [it, inserted] = m_applications.try_emplace(proc.session_name);
+    if (inserted)
+        it->second.m_display_name = proc.display_name;
+    it->second.m_processes[proc.pid] = proc.x64;
+}
+
+void application_manager::remove(const process& proc)
+{
+    auto it = m_applications.find(proc.session_name);
+    if (it == m_applications.end())
+        return;
+
+    it->second.m_processes.erase(proc.pid);
+    if (it->second.m_processes.empty())
+        m_applications.erase(it);
+}
+
+void application_manager::clear()
+{
+    m_applications.clear();
+    m_known.clear();
+}
+
+bool application_manager::contains(const std::string& session_name) const
+{
+    return m_applications.find(session_name) != m_applications.end();
+}
+
+size_t application_manager::size() const
+{
+    return m_applications.size();
+}
+
+// Only pids that weren't around last time, or now belong to a process that
+// started since, get described, and only pids that went away get removed, so
+// the work past enumerating stays proportional to what actually changed.
+bool application_manager::refresh(delta& changes)
+{
+    changes.clear();
+
+    if (!m_backend)
+        return false;
+
+    m_sessions.clear();
+    if (!m_backend->enumerate(m_sessions))
+        return false;
+
+    m_generation++;
+
+    for (const auto& session : m_sessions) {
+        auto [it, inserted] = m_known.try_emplace(session.pid);
+        known_process& known = it->second;
+
+        // the pid was handed to a new process in between refreshes, which
+        // gets described again as if it had never been seen
+        if (!inserted && session.start_time && known.start_time
+            && session.start_time != known.start_time) {
+            if (known.described)
+                changes.removed.push_back(std::move(known.proc));
+            known = known_process {};
+            inserted = true;
+        }
+
+        if (session.start_time)
+            known.start_time = session.start_time;
+        known.generation = m_generation;
+
+        if (inserted)
+            known.retry_at = m_generation;
+        if (known.described || known.retry_at > m_generation)
+            continue;
+
+        // a process that's only just starting up can fail to open
+        if (!describe(known, session.pid))
+            continue;
+
+        known.proc.display_name = session.display_name;
+        changes.added.push_back(known.proc);
+    }
+
+    for (auto it = m_known.begin(); it != m_known.end();) {
+        if (it->second.generation == m_generation) {
+            it++;
+            continue;
+        }
+
+        if (it->second.described)
+            changes.removed.push_back(std::move(it->second.proc));
+        it = m_known.erase(it);
+    }
+
+    return true;
+}
+
+void application_manager::apply(const delta& changes)
+{
+    for (const auto& proc : changes.removed)
+        remove(proc);
+    for (const auto& proc : changes.added)
+        add(proc);
+}
+
+// Only keeps what describe() found if it worked, otherwise puts off trying
+// again for twice as long as last time.
+bool application_manager::describe(known_process& known, uint32_t pid)
+{
+    process proc;
+    proc.pid = pid;
+
+    if (!m_backend->describe(pid, proc.session_name, proc.x64)) {
+        uint64_t backoff = std::min<uint64_t>(1ULL << std::min(known.failures, 31U),
+            MAX_DESCRIBE_BACKOFF);
+        known.failures++;
+        known.retry_at = m_generation + backoff;
+        return false;
+    }
+
+    known.proc = std::move(proc);
+    known.described = true;
+    known.failures = 0;
+    return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct audio_session {
+    uint32_t pid;
+    std::wstring display_name;
+
+    // when the process started, in whatever unit the backend likes, or 0 if
+    // it couldn't tell. Tells a reused pid apart from the process before it.
+    uint64_t start_time = 0;
+};
+
+// Where application_manager finds out about audio sessions. WASAPI is the real
+// one; anything else is for driving the manager without Windows around.
+class session_backend {
+public:
+    virtual ~session_backend() = default;
+
+    // Lists the pid and start time of every current audio session. Runs on
+    // every refresh, so it should do as little per session as possible.
+    virtual bool enumerate(std::vector<audio_session>& sessions) = 0;
+
+    // Looks up the executable name and bitness of a pid. Only runs for pids
+    // that weren't around on the last refresh, started over since, or that it
+    // failed for before.
+    virtual bool describe(uint32_t pid, std::string& session_name, bool& x64) = 0;
+};
+
+class application_manager {
+public:
+    class application {
+        friend class application_manager;
+
+    public:
+        const std::unordered_map<uint32_t, bool>& processes() const;
+        const std::wstring& display_name() const;
+        bool contains(uint32_t pid) const;
+
+    private:
+        std::unordered_map<uint32_t, bool> m_processes;
+        std::wstring m_display_name;
+    };
+
+    struct process {
+        std::string session_name;
+        std::wstring display_name;
+        uint32_t pid = 0;
+        bool x64 = false;
+    };
+
+    // What changed over one refresh.
+    struct delta {
+        std::vector<process> added;
+        std::vector<process> removed;
+
+        bool empty() const { return added.empty() && removed.empty(); }
+        void clear();
+    };
+
+public:
+    application_manager() = default;
+    application_manager(std::unique_ptr<session_backend> backend);
+
+    void set_backend(std::unique_ptr<session_backend> backend);
+    const std::unordered_map<std::string, application>& applications() const;
+    void clear();
+    bool contains(const std::string& session_name) const;
+    size_t size() const;
+
+    // Works out what changed since the last refresh without touching
+    // applications(), so it can run while somebody else is reading those.
+    // apply() then brings applications() up to date.
+    bool refresh(delta& changes);
+    void apply(const delta& changes);
+
+private:
+    void add(const process& proc);
+    void remove(const process& proc);
+
+    std::unique_ptr<session_backend> m_backend;
+    std::unordered_map<std::string, application> m_applications;
+
+    struct known_process {
+        process proc;
+        uint64_t start_time;
+        uint64_t generation;
+        bool described;
+
+        // describes that failed in a row, and the refresh to try again at
+        uint32_t failures;
+        uint64_t retry_at;
+    };
+
+    bool describe(known_process& known, uint32_t pid);
+
+    // every pid seen so far, stamped with the last refresh it showed up in,
+    // including ones that couldn't be described yet, which are retried less
+    // and less often. Forgotten as soon as a refresh doesn't list it.
+    std::unordered_map<uint32_t, known_process> m_known;
+    std::vector<audio_session> m_sessions;
+    uint64_t m_generation = 0;
+};
@@ -1,16 +1,18 @@
 #include "audio-helpers.h"
+#include "audio-kernels.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <functional>
+#include <string.h>
 
-#include <Psapi.h>
+#ifdef _WIN32
 #include <Windows.h>
-#include <audioclient.h>
-#include <audiopolicy.h>
-#include <mmdeviceapi.h>
-#include <mmeapi.h>
+#endif
 
 #include <obs-module.h>
 #include <util/platform.h>
+#include <util/util_uint64.h>
 
 using namespace std::placeholders;
 
@@ -62,434 +64,995 @@ AVSampleFormat obs_format_to_swr_format(audio_format format)
     }
 }
 
+// The formats convert_samples() handles without swr.
+bool obs_format_to_sample_format(audio_format format, sample_format& out,
+    bool& planar)
+{
+    planar = is_audio_planar(format);
+
+    switch (format) {
+    case AUDIO_FORMAT_U8BIT:
+    case AUDIO_FORMAT_U8BIT_PLANAR:
+        out = sample_format::u8;
+        return true;
+    case AUDIO_FORMAT_16BIT:
+    case AUDIO_FORMAT_16BIT_PLANAR:
+        out = sample_format::s16;
+        return true;
+    case AUDIO_FORMAT_32BIT:
+    case AUDIO_FORMAT_32BIT_PLANAR:
+        out = sample_format::s32;
+        return true;
+    case AUDIO_FORMAT_FLOAT:
+    case AUDIO_FORMAT_FLOAT_PLANAR:
+        out = sample_format::f32;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Counters that only ever have the one thread writing to them, so the add
+// doesn't have to be atomic, only the load and store for whoever reads them.
+static inline void count(std::atomic<uint64_t>& counter, uint64_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed);
+}
+
 //-----------------------------------------------------------------[ audio_mixer
 
+// What every packet in an input starts with.
+struct input_packet {
+    uint64_t epoch;
+    uint64_t position;
+    uint64_t trace;
+    uint32_t frames;
+    uint32_t channels;
+    sample_format format;
+    uint32_t downmix;
+};
+
+audio_mixer::input::input(size_t capacity)
+    : m_memory((message_ring::required_size(capacity) + 63) / 64)
+    , m_capacity(capacity)
+{
+    m_ring.init(m_memory.data(), capacity);
+}
+
+bool audio_mixer::input::push_frames(const float* samples,
+    size_t frames_count, uint32_t channels, uint64_t epoch, uint64_t position,
+    uint64_t trace)
+{
+    input_packet packet = {
+        .epoch = epoch,
+        .position = position,
+        .trace = trace,
+        .frames = (uint32_t)frames_count,
+        .channels = channels,
+        .format = sample_format::f32,
+        .downmix = false,
+    };
+
+    bool needs_wake;
+    return m_ring.write((const uint8_t*)&packet, sizeof(packet),
+        (const uint8_t*)samples, frames_count * channels * sizeof(float),
+        needs_wake);
+}
+
+bool audio_mixer::input::push_downmix(const void* samples,
+    sample_format format, uint32_t channels, size_t frames_count,
+    uint64_t epoch, uint64_t position, uint64_t trace)
+{
+    input_packet packet = {
+        .epoch = epoch,
+        .position = position,
+        .trace = trace,
+        .frames = (uint32_t)frames_count,
+        .channels = channels,
+        .format = format,
+        .downmix = true,
+    };
+
+    bool needs_wake;
+    return m_ring.write((const uint8_t*)&packet, sizeof(packet),
+        (const uint8_t*)samples,
+        frames_count * channels * sample_format_size(format), needs_wake);
+}
+
+size_t audio_mixer::input::capacity() const
+{
+    return m_capacity;
+}
+
+uint64_t audio_mixer::input::dropped_frames() const
+{
+    return m_dropped_frames.load(std::memory_order_relaxed);
+}
+
+uint64_t audio_mixer::input::rejected_frames() const
+{
+    return m_rejected_frames.load(std::memory_order_relaxed);
+}
+
 audio_mixer::audio_mixer(size_t size)
+    : m_mix_packet([this](uint8_t* packet, size_t size) { mix_packet(packet, size); })
 {
     resize(size);
 }
 
-size_t audio_mixer::calculate_index(uint64_t timestamp) const
+// Timestamps before the epoch land on position 0.
+uint64_t audio_mixer::calculate_position(uint64_t timestamp) const
 {
-    return calculate_size(timestamp - m_timestamp);
+    uint64_t epoch = this->epoch();
+    return timestamp > epoch ? calculate_size(timestamp - epoch) : 0;
 }
 
-size_t audio_mixer::calculate_size(uint64_t duration)
+size_t audio_mixer::calculate_size(uint64_t duration) const
 {
-    return (size_t)(duration * AUDIO_RESAMPLE_SAMPLE_RATE * 1e-9);
+    return (size_t)util_mul_div64(duration, sample_rate(), 1'000'000'000);
 }
 
-uint64_t audio_mixer::calculate_timestamp(size_t index) const
+// Always worked out from the epoch rather than added up from the previous
+// one, so the timestamps of a long stream never drift off the sample count.
+uint64_t audio_mixer::calculate_timestamp(uint64_t position) const
 {
-    return calculate_duration(index) + m_timestamp;
+    return calculate_duration(position) + epoch();
 }
 
-uint64_t audio_mixer::calculate_duration(size_t size)
+uint64_t audio_mixer::calculate_duration(uint64_t size) const
 {
-    return (uint64_t)(size * 1e9) / AUDIO_RESAMPLE_SAMPLE_RATE;
+    return util_mul_div64(size, 1'000'000'000, sample_rate());
 }
 
 void audio_mixer::resize(size_t size)
 {
-    std::lock_guard lock = std::lock_guard(m_mutex);
+    size_t block_size = size / NUM_BLOCKS;
+    if (block_size == m_block_size)
+        return;
+
+    reset(block_size, sample_rate(), speakers());
+}
+
+size_t audio_mixer::size() const
+{
+    return m_block_size * NUM_BLOCKS;
+}
 
-    size_t individual_vec_size = size / NUM_VECS;
-    if (individual_vec_size * NUM_VECS == m_size)
+// Keeps the buffer at the same duration, so only the frame count changes.
+void audio_mixer::set_format(int sample_rate, speaker_layout speakers)
+{
+    if (sample_rate <= 0 || get_audio_channels(speakers) == 0)
         return;
 
-    m_size = individual_vec_size * NUM_VECS;
+    int old_sample_rate = this->sample_rate();
+    if (sample_rate == old_sample_rate && speakers == this->speakers())
+        return;
 
-    m_vecs.clear();
-    for (int i = 0; i < NUM_VECS; i++)
-        m_vecs.emplace_back(individual_vec_size);
+    size_t block_size = (size_t)((uint64_t)m_block_size * sample_rate / old_sample_rate);
 
-    m_timestamp = os_gettime_ns() - calculate_duration(m_size / NUM_VECS);
+    reset(block_size, sample_rate, speakers);
 }
 
-size_t audio_mixer::size() const
+int audio_mixer::sample_rate() const
 {
-    return m_size;
+    return m_sample_rate.load(std::memory_order_relaxed);
+}
+
+speaker_layout audio_mixer::speakers() const
+{
+    return m_speakers.load(std::memory_order_relaxed);
 }
 
 bool audio_mixer::ready_to_pop() const
 {
-    uint64_t delta = os_gettime_ns() - m_timestamp;
-    return delta > calculate_duration(m_size / NUM_VECS);
+    return os_gettime_ns() > pop_deadline();
+}
+
+// The front block is ready once all of the past buffer is behind it.
+uint64_t audio_mixer::pop_deadline() const
+{
+    if (m_block_size == 0)
+        return UINT64_MAX;
+
+    return calculate_timestamp(m_position + m_block_size);
 }
 
 uint64_t audio_mixer::timestamp() const
 {
-    return m_timestamp;
+    return calculate_timestamp(m_position);
 }
 
-std::vector<audio_frame> audio_mixer::pop()
+// Changes on every resize, along with every position on the timeline.
+uint64_t audio_mixer::epoch() const
 {
-    std::lock_guard lock = std::lock_guard(m_mutex);
+    return m_epoch.load(std::memory_order_acquire);
+}
+
+// Mixes everything the inputs have queued up so far, then lends out the
+// front block.
+audio_mixer::block_view audio_mixer::pop()
+{
+    if (m_block_size == 0)
+        return {};
+
+    drain();
+
+    block& b = block_at(m_position, m_block_size);
+    uint64_t position = m_position;
+    m_position += m_block_size;
+
+    return {
+        .samples = b.samples.data(),
+        .size = b.size,
+        .sample_rate = sample_rate(),
+        .speakers = speakers(),
+        .position = position,
+        .timestamp = calculate_timestamp(position),
+        .traces = b.traces.data(),
+        .traces_count = b.traces.size(),
+    };
+}
 
-    std::vector<audio_frame> ret = m_vecs[0];
-    m_vecs.pop_front();
-    m_vecs.emplace_back(ret.size());
+void audio_mixer::release(const block_view& view)
+{
+    if (!view.samples || view.size != m_block_size)
+        return;
+
+    block& b = block_at(view.position, view.size);
+    if (b.position != view.position)
+        return;
 
-    m_timestamp += calculate_duration(m_size / NUM_VECS);
-    return ret;
+    std::fill(b.samples.begin(), b.samples.end(), 0.0f);
+    b.traces.clear();
+    b.position += (uint64_t)NUM_BLOCKS * view.size;
 }
 
-void audio_mixer::mix_frames(const audio_frame* frames_buffer,
-    size_t frames_count, size_t index)
+// What an input added now gets sized to, which follows the blocks.
+size_t audio_mixer::input_capacity() const
 {
-    std::lock_guard lock = std::lock_guard(m_mutex);
+    return m_input_capacity.load(std::memory_order_relaxed);
+}
+
+std::shared_ptr<audio_mixer::input> audio_mixer::add_input()
+{
+    auto in = std::make_shared<input>(input_capacity());
+
+    std::lock_guard lock = std::lock_guard(m_inputs_mutex);
+    m_inputs.push_back(in);
+    return in;
+}
+
+// The stream may still hold on to it for a bit, but it won't be read again.
+void audio_mixer::remove_input(const std::shared_ptr<input>& in)
+{
+    std::lock_guard lock = std::lock_guard(m_inputs_mutex);
+    m_inputs.erase(std::remove(m_inputs.begin(), m_inputs.end(), in),
+        m_inputs.end());
+}
+
+void audio_mixer::drain()
+{
+    std::lock_guard lock = std::lock_guard(m_inputs_mutex);
+    for (auto& in : m_inputs) {
+        m_draining = in.get();
+        in->m_ring.read(m_mix_packet);
+    }
+    m_draining = nullptr;
+}
+
+// Packets from before the last resize, or converted for a different format,
+// get thrown away.
+void audio_mixer::mix_packet(const uint8_t* packet, size_t size)
+{
+    if (size < sizeof(input_packet))
+        return;
 
-    size_t vec_size = m_size / NUM_VECS;
+    input_packet header;
+    memcpy(&header, packet, sizeof(header));
+    const uint8_t* samples = packet + sizeof(header);
+
+    if (header.epoch != epoch()) {
+        if (m_draining)
+            count(m_draining->m_rejected_frames, header.frames);
+        return;
+    }
+
+    if (header.trace)
+        latency_tracer::get().record(trace_stage::mix, header.trace,
+            os_gettime_ns());
+
+    size_t mixed;
+    if (header.downmix) {
+        size_t frame_size = sample_format_size(header.format) * header.channels;
+        mixed = for_each_span(header.frames, 2, header.position, header.trace,
+            [&](float* dst, size_t frame, size_t count) {
+                downmix_samples(dst, samples + frame * frame_size,
+                    header.format, header.channels, count);
+            });
+    } else {
+        const float* frames = (const float*)samples;
+        mixed = for_each_span(header.frames, header.channels, header.position,
+            header.trace, [&](float* dst, size_t frame, size_t count) {
+                mix_samples(dst, &frames[frame * header.channels],
+                    count * header.channels);
+            });
+    }
+
+    if (mixed < header.frames && m_draining)
+        count(m_draining->m_dropped_frames, header.frames - mixed);
+}
+
+// Calls func with each stretch of the frames that lands inside one block,
+// and returns how many frames did. Every block they land in gets tagged with
+// trace, if the packet is being traced.
+template <typename F>
+size_t audio_mixer::for_each_span(size_t frames_count, uint32_t channels,
+    uint64_t position, uint64_t trace, F&& func)
+{
+    if (m_block_size == 0 || m_blocks[0].channels != channels)
+        return 0;
+
+    uint64_t front = m_position;
+    uint64_t back = front + (uint64_t)NUM_BLOCKS * m_block_size;
 
-    unsigned int vec = (unsigned int)(index / vec_size);
-    unsigned int vec_index = (unsigned int)(index % vec_size);
     size_t frame = 0;
-    while (frame < frames_count && vec < m_vecs.size()) {
-        for (int i = 0; i < AUDIO_RESAMPLE_CHANNELS; i++)
-            m_vecs[vec][vec_index].samples[i] += frames_buffer[frame].samples[i];
-
-        frame++;
-        vec_index++;
-        if (vec_index >= vec_size) {
-            vec_index = 0;
-            vec++;
-        }
+    if (position < front) {
+        if (front - position >= frames_count)
+            return 0;
+        frame = (size_t)(front - position);
+        position = front;
+    }
+
+    size_t mixed = 0;
+    while (frame < frames_count && position < back) {
+        uint64_t block_position = position - position % m_block_size;
+        size_t block_index = (size_t)(position - block_position);
+        size_t count = std::min(frames_count - frame, m_block_size - block_index);
+
+        block& b = block_at(position, m_block_size);
+        func(&b.samples[block_index * channels], frame, count);
+        if (trace && (b.traces.empty() || b.traces.back() != trace)
+            && b.traces.size() < MAX_BLOCK_TRACES)
+            b.traces.push_back(trace);
+
+        frame += count;
+        position += count;
+        mixed += count;
+    }
+
+    return mixed;
+}
+
+void audio_mixer::reset(size_t block_size, int sample_rate,
+    speaker_layout speakers)
+{
+    uint32_t channels = get_audio_channels(speakers);
+
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        m_blocks[i].samples.assign(block_size * channels, 0.0f);
+        m_blocks[i].size = block_size;
+        m_blocks[i].channels = channels;
+        m_blocks[i].position = (uint64_t)i * block_size;
+        m_blocks[i].traces.clear();
+        m_blocks[i].traces.reserve(MAX_BLOCK_TRACES);
     }
+
+    m_sample_rate.store(sample_rate, std::memory_order_relaxed);
+    m_speakers.store(speakers, std::memory_order_relaxed);
+    size_t input_capacity = (size_t)NUM_BLOCKS * block_size * MAX_AUDIO_CHANNELS
+        * sizeof(float);
+    m_input_capacity.store(std::max(input_capacity, MIN_INPUT_CAPACITY),
+        std::memory_order_relaxed);
+
+    m_epoch.store(os_gettime_ns() - calculate_duration(block_size),
+        std::memory_order_release);
+    m_position = 0;
+    m_block_size = block_size;
 }
 
-void audio_mixer::mix_frames(const std::vector<audio_frame>& frames,
-    size_t index)
+audio_mixer::block& audio_mixer::block_at(uint64_t position, size_t block_size)
 {
-    mix_frames(frames.data(), frames.size(), index);
+    return m_blocks[(position / block_size) % NUM_BLOCKS];
 }
 
 //--------------------------------------------------------------------[ file out
 
+#if defined(_WIN32) && defined(_DEBUG)
+
 HANDLE create_file(const char* path)
 {
-#if _DEBUG
     return CreateFileA(path, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
         OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-#endif
 }
 
 void write_file(HANDLE file, void* buffer, DWORD size)
 {
-#if _DEBUG
     WriteFile(file, buffer, size, NULL, NULL);
-#endif
 }
 
 void free_file(HANDLE file)
 {
-#if _DEBUG
     CloseHandle(file);
+}
+
 #endif
+
+//--------------------------------------------------------------[ resampler_pool
+
+resampler_pool::~resampler_pool()
+{
+    for (auto& [k, ctx] : m_idle)
+        swr_free(&ctx);
+}
+
+SwrContext* resampler_pool::acquire(const key& k)
+{
+    {
+        std::lock_guard lock = std::lock_guard(m_mutex);
+
+        auto it = m_idle.find(k);
+        if (it != m_idle.end()) {
+            SwrContext* ctx = it->second;
+            m_idle.erase(it);
+            return ctx;
+        }
+    }
+
+    SwrContext* ctx = swr_alloc_set_opts(NULL, k.out_layout,
+        AUDIO_RESAMPLE_AV_SAMPLE_FMT, k.out_rate, k.in_layout, k.in_format,
+        k.in_rate, 0, NULL);
+    if (ctx && swr_init(ctx) < 0)
+        swr_free(&ctx);
+
+    return ctx;
+}
+
+void resampler_pool::release(const key& k, SwrContext* ctx)
+{
+    if (!ctx)
+        return;
+
+    // drops buffered frames and compensation along with everything else
+    swr_init(ctx);
+
+    {
+        std::lock_guard lock = std::lock_guard(m_mutex);
+
+        if (m_idle.size() < MAX_IDLE) {
+            m_idle.emplace(k, ctx);
+            return;
+        }
+    }
+
+    swr_free(&ctx);
+}
+
+size_t resampler_pool::idle() const
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+    return m_idle.size();
+}
+
+size_t resampler_pool::key_hash::operator()(const key& k) const
+{
+    size_t hash = std::hash<int64_t>()(k.in_layout);
+    for (int64_t value : { (int64_t)k.in_format, (int64_t)k.in_rate,
+             k.out_layout, (int64_t)k.out_rate })
+        hash = hash * 31 + std::hash<int64_t>()(value);
+    return hash;
 }
 
 //----------------------------------------------[ audio_pipe_manager::audio_pipe
 
-audio_pipe_manager::audio_pipe::audio_pipe(std::string_view name,
-    audio_mixer* mixer)
-    : m_receiver { name, std::bind(&audio_pipe::read, this, _1, _2) }
+audio_pipe_manager::audio_pipe::audio_pipe(audio_pipe_manager& manager,
+    uint32_t pid, const std::vector<audio_mixer*>& mixers)
+    : m_manager(manager)
+    , m_pid(pid)
     , m_info {
-        .mixer = mixer,
-        .layout = AUDIO_RESAMPLE_AV_CH_LAYOUT,
+        .swr_ctx = nullptr,
+        .swr_key = {},
+        .layout = obs_layout_to_swr_layout(AUDIO_RESAMPLE_DEFAULT_SPEAKERS),
         .format = AUDIO_RESAMPLE_AV_SAMPLE_FMT,
-        .sample_rate = AUDIO_RESAMPLE_SAMPLE_RATE,
+        .sample_rate = AUDIO_RESAMPLE_DEFAULT_RATE,
+        .out_sample_rate = AUDIO_RESAMPLE_DEFAULT_RATE,
+        .out_speakers = AUDIO_RESAMPLE_DEFAULT_SPEAKERS,
     }
 {
-    // by default should basically do nothing and assume that the input
-    // audio is the same encoding as the desired output
-    m_info.swr_ctx = swr_alloc_set_opts(
-        NULL, AUDIO_RESAMPLE_AV_CH_LAYOUT, AUDIO_RESAMPLE_AV_SAMPLE_FMT,
-        AUDIO_RESAMPLE_SAMPLE_RATE, AUDIO_RESAMPLE_AV_CH_LAYOUT,
-        AUDIO_RESAMPLE_AV_SAMPLE_FMT, AUDIO_RESAMPLE_SAMPLE_RATE, 0,
-        NULL);
+    set_mixers(mixers);
 
-    swr_init(m_info.swr_ctx);
+    m_receiver = create_audio_receiver(manager.m_transport, pid,
+        std::bind(&audio_pipe::read, this, _1, _2), manager.m_io_loop);
 }
 
-audio_pipe_manager::audio_pipe::audio_pipe(audio_pipe&& other) noexcept
-    : m_receiver { std::move(other.m_receiver) }
-    , m_info { other.m_info }
+audio_pipe_manager::audio_pipe::~audio_pipe()
 {
-    other.m_info = { 0 };
+    // stop the receiver before pulling anything out from under it
+    m_receiver.reset();
+
+    for (auto& sub : m_subscribers)
+        sub.mixer->remove_input(sub.input);
 
-    m_receiver.set_callback(std::bind(&audio_pipe::read, this, _1, _2));
+    release_resampler();
 }
 
-audio_pipe_manager::audio_pipe::~audio_pipe()
+// Mixers that stay subscribed keep their place on the timeline.
+void audio_pipe_manager::audio_pipe::set_mixers(
+    const std::vector<audio_mixer*>& mixers)
 {
-    if (m_info.swr_ctx)
-        swr_free(&m_info.swr_ctx);
+    std::lock_guard lock = std::lock_guard(m_subscribers_mutex);
+
+    std::vector<subscriber> subscribers;
+    for (auto* mixer : mixers) {
+        auto it = std::find_if(m_subscribers.begin(), m_subscribers.end(),
+            [mixer](const subscriber& sub) { return sub.mixer == mixer; });
+        if (it != m_subscribers.end()) {
+            subscribers.push_back(std::move(*it));
+            m_subscribers.erase(it);
+        } else {
+            subscribers.push_back({
+                .mixer = mixer,
+                .input = mixer->add_input(),
+                .anchor = UINT64_MAX,
+            });
+        }
+    }
+
+    // whatever is left over got unsubscribed
+    for (auto& sub : m_subscribers)
+        sub.mixer->remove_input(sub.input);
+
+    m_subscribers = std::move(subscribers);
 }
 
-audio_pipe_manager::audio_pipe&
-audio_pipe_manager::audio_pipe::operator=(audio_pipe&& other) noexcept
+std::vector<audio_mixer*> audio_pipe_manager::audio_pipe::mixers() const
 {
-    m_receiver = std::move(other.m_receiver);
-    m_info = other.m_info;
-    other.m_info = { 0 };
+    std::lock_guard lock = std::lock_guard(m_subscribers_mutex);
 
-    m_receiver.set_callback(std::bind(&audio_pipe::read, this, _1, _2));
+    std::vector<audio_mixer*> mixers;
+    for (auto& sub : m_subscribers)
+        mixers.push_back(sub.mixer);
+    return mixers;
+}
 
-    return *this;
+audio_pipe_stats audio_pipe_manager::audio_pipe::stats() const
+{
+    audio_pipe_stats stats = {
+        .pid = m_pid,
+        .packets = m_stats.packets.load(std::memory_order_relaxed),
+        .bytes = m_stats.bytes.load(std::memory_order_relaxed),
+        .frames = m_stats.frames.load(std::memory_order_relaxed),
+        .format_changes = m_stats.format_changes.load(std::memory_order_relaxed),
+        .contiguous = m_stats.contiguous.load(std::memory_order_relaxed),
+        .discontiguous = m_stats.discontiguous.load(std::memory_order_relaxed),
+        .dropped_frames = m_stats.dropped_frames.load(std::memory_order_relaxed),
+        .rejected_frames = m_stats.rejected_frames.load(std::memory_order_relaxed),
+    };
+
+    std::lock_guard lock = std::lock_guard(m_subscribers_mutex);
+    for (auto& sub : m_subscribers) {
+        stats.dropped_frames += sub.input->dropped_frames();
+        stats.rejected_frames += sub.input->rejected_frames();
+    }
+    return stats;
 }
 
 void audio_pipe_manager::audio_pipe::read(uint8_t* buffer, size_t size)
 {
-    auto*& mixer = m_info.mixer;
     auto*& swr_ctx = m_info.swr_ctx;
     auto& layout = m_info.layout;
     auto& format = m_info.format;
     auto& sample_rate = m_info.sample_rate;
-    auto& last_timestamp = m_info.last_timestamp;
+    auto& stream_position = m_info.stream_position;
+
+    if (m_manager.m_recorder.recording())
+        m_manager.m_recorder.write(m_pid, os_gettime_ns(), buffer, size);
 
     if (size < sizeof(struct audio_metadata))
         return;
 
-    uint64_t timestamp = os_gettime_ns();
-
     struct audio_metadata* md = (struct audio_metadata*)buffer;
     const uint8_t* data = (uint8_t*)buffer + sizeof(struct audio_metadata);
 
+    if (md->magic != AUDIO_PROTOCOL_MAGIC || md->version != AUDIO_PROTOCOL_VERSION) {
+        if (!m_info.warned_version) {
+            blog(LOG_WARNING, "obs-app-audio hook speaks an unsupported protocol, restart the application to update it");
+            m_info.warned_version = true;
+        }
+        return;
+    }
+
+    count(m_stats.packets);
+    count(m_stats.bytes, size);
+    count(m_stats.frames, md->frames);
+
+    // the hook stamps packets as the app releases them, on the same clock
+    auto& tracer = latency_tracer::get();
+    m_info.trace = 0;
+    if (tracer.tracing()) {
+        m_info.trace = make_trace_id(m_pid, ++m_info.trace_sequence);
+        tracer.record(trace_stage::hook, m_info.trace, md->timestamp);
+        tracer.record(trace_stage::receipt, m_info.trace, os_gettime_ns());
+    }
+
+    std::lock_guard lock = std::lock_guard(m_subscribers_mutex);
+    if (m_subscribers.empty())
+        return;
+
+    uint64_t timestamp = md->timestamp;
+
     int64_t av_layout = obs_layout_to_swr_layout(md->layout);
     enum AVSampleFormat av_format = obs_format_to_swr_format(md->format);
 
-    if (av_layout != layout || av_format != format || md->samples_per_sec != sample_rate) {
-        swr_ctx = swr_alloc_set_opts(NULL, AUDIO_RESAMPLE_AV_CH_LAYOUT,
-            AUDIO_RESAMPLE_AV_SAMPLE_FMT,
-            AUDIO_RESAMPLE_SAMPLE_RATE,
-            av_layout, av_format,
-            md->samples_per_sec, 0, NULL);
-        swr_init(swr_ctx);
+    // every mixer follows OBS's output format, so any one of them will do,
+    // and OBS's output format can change under a running source too
+    audio_mixer* mixer = m_subscribers.front().mixer;
+    int out_sample_rate = mixer->sample_rate();
+    speaker_layout out_speakers = mixer->speakers();
+
+    if (av_layout != layout || av_format != format || md->samples_per_sec != sample_rate
+        || out_sample_rate != m_info.out_sample_rate || out_speakers != m_info.out_speakers) {
+        count(m_stats.format_changes);
+        release_resampler();
         layout = av_layout;
         format = av_format;
         sample_rate = md->samples_per_sec;
+        m_info.out_sample_rate = out_sample_rate;
+        m_info.out_speakers = out_speakers;
+        m_info.compensation = 0;
+        m_info.anchor_timestamp = 0;
+        m_drift.reset();
     }
 
-    uint8_t* resampled_data;
-    int resampled_frames = (int)av_rescale_rnd(md->frames, AUDIO_RESAMPLE_SAMPLE_RATE,
-        md->samples_per_sec, AV_ROUND_UP);
-    av_samples_alloc(&resampled_data, NULL, AUDIO_RESAMPLE_CHANNELS,
-        resampled_frames, AUDIO_RESAMPLE_AV_SAMPLE_FMT, 0);
-    resampled_frames = swr_convert(swr_ctx, &resampled_data,
-        resampled_frames, &data, md->frames);
-
-    uint64_t expected_timestamp = last_timestamp + mixer->calculate_duration(resampled_frames);
+    // snap onto the end of the previous packet in sample space, so that
+    // contiguous packets stay sample-exact no matter how the clocks round
+    uint64_t expected_timestamp = m_info.anchor_timestamp
+        + util_mul_div64(stream_position, 1'000'000'000, out_sample_rate);
 
     uint64_t deviation = timestamp < expected_timestamp
         ? expected_timestamp - timestamp
         : timestamp - expected_timestamp;
-    uint64_t epsilon = audio_mixer::calculate_duration(mixer->size()) * (audio_mixer::NUM_VECS - 1) / audio_mixer::NUM_VECS;
+    bool contiguous = m_info.anchor_timestamp && deviation < TIMESTAMP_EPSILON;
+    count(contiguous ? m_stats.contiguous : m_stats.discontiguous);
+
+    // keep the stream locked onto the timeline by stretching or squeezing it
+    // ever so slightly, instead of letting drift build up until it snaps
+    if (contiguous)
+        m_drift.update((int64_t)(timestamp - expected_timestamp));
+    else
+        m_drift.reset();
+
+    // at exactly the mixer's rate and layout, or in surround going to stereo,
+    // the samples at most need their format converted or downmixing, and
+    // while the stream keeps close to the timeline they need no stretching
+    // either, so swr gets skipped altogether
+    sample_format direct_format;
+    bool direct_planar;
+    uint32_t in_channels = get_audio_channels(md->layout);
+    bool direct_downmix = out_speakers == SPEAKERS_STEREO
+        && downmix_supported(in_channels);
+    bool same_format = obs_format_to_sample_format(md->format, direct_format, direct_planar)
+        && (md->layout == out_speakers || (direct_downmix && !direct_planar))
+        && md->samples_per_sec == out_sample_rate;
+    uint64_t drift = (uint64_t)std::abs(m_drift.error());
+
+    if (!same_format || drift > PASSTHROUGH_MAX_DRIFT)
+        m_info.passthrough = false;
+    else if (!m_info.passthrough && drift < PASSTHROUGH_RESUME_DRIFT) {
+        flush_resampler(contiguous, timestamp);
+        m_info.passthrough = true;
+    }
 
-    if (deviation < epsilon)
-        timestamp = expected_timestamp;
+    // anything that isn't contiguous starts the stream's timeline over
+    if (!contiguous) {
+        m_info.anchor_timestamp = timestamp;
+        m_info.anchor++;
+        stream_position = 0;
+    }
+
+    if (!m_info.passthrough) {
+        if (!swr_ctx && !acquire_resampler())
+            return;
 
-    size_t index = mixer->calculate_index(timestamp);
-    mixer->mix_frames((struct audio_frame*)resampled_data,
-        resampled_frames, index);
+        int compensation = m_drift.compensation(out_sample_rate);
+        if (compensation != 0 || m_info.compensation != 0) {
+            swr_set_compensation(swr_ctx, compensation, out_sample_rate);
+            m_info.compensation = compensation;
+        }
+    }
 
-    last_timestamp = timestamp;
-    av_freep(&resampled_data);
+    // nothing to mix, the mixer's blocks start out silent, so the gap only
+    // has to move the stream along the timeline
+    if (md->flags & AUDIO_METADATA_SILENT) {
+        // what swr still has from before the gap goes right before it, and
+        // swr starts over after it rather than carry the tail on past it
+        if (swr_ctx && drain_resampler(contiguous, timestamp)) {
+            swr_init(swr_ctx);
+            m_info.compensation = 0;
+        }
+
+        stream_position += av_rescale_rnd(md->frames, out_sample_rate,
+            md->samples_per_sec, AV_ROUND_NEAR_INF);
+        return;
+    }
+
+    uint32_t channels = get_audio_channels(out_speakers);
+
+    if (m_info.passthrough) {
+        size_t samples = (size_t)md->frames * in_channels;
+        if (size - sizeof(struct audio_metadata) < samples * sample_format_size(direct_format))
+            return;
+
+        if (md->layout != out_speakers) {
+            downmix(data, direct_format, in_channels, md->frames, timestamp);
+            return;
+        }
+
+        // interleaved float gets mixed straight out of the received buffer
+        if (direct_format == sample_format::f32 && !direct_planar) {
+            mix((const float*)data, md->frames, channels, timestamp);
+            return;
+        }
+
+        if (m_buffer.size() < samples)
+            m_buffer.resize(samples);
+
+        convert_samples(m_buffer.data(), data, direct_format, direct_planar,
+            channels, md->frames);
+        mix(m_buffer.data(), md->frames, channels, timestamp);
+        return;
+    }
+
+    // swr may still be holding on to a few frames from the last packet
+    int resampled_frames = (int)av_rescale_rnd(
+        swr_get_delay(swr_ctx, md->samples_per_sec) + md->frames,
+        out_sample_rate, md->samples_per_sec, AV_ROUND_UP);
+    if (m_buffer.size() < (size_t)resampled_frames * channels)
+        m_buffer.resize((size_t)resampled_frames * channels);
+
+    uint8_t* resampled_data = (uint8_t*)m_buffer.data();
+    resampled_frames = swr_convert(swr_ctx, &resampled_data,
+        resampled_frames, &data, md->frames);
+    if (resampled_frames <= 0)
+        return;
+
+    mix(m_buffer.data(), resampled_frames, channels, timestamp);
 }
 
-//----------------------------------------------------------[ audio_pipe_manager
+// Takes a resampler for the stream's current formats from the pool.
+bool audio_pipe_manager::audio_pipe::acquire_resampler()
+{
+    m_info.swr_key = {
+        .in_layout = m_info.layout,
+        .in_format = m_info.format,
+        .in_rate = m_info.sample_rate,
+        .out_layout = obs_layout_to_swr_layout(m_info.out_speakers),
+        .out_rate = m_info.out_sample_rate,
+    };
+    m_info.swr_ctx = m_manager.m_resamplers.acquire(m_info.swr_key);
+    m_info.compensation = 0;
+    return m_info.swr_ctx != nullptr;
+}
 
-audio_pipe_manager::audio_pipe_manager(audio_mixer& mixer)
-    : m_mixer(&mixer)
+void audio_pipe_manager::audio_pipe::release_resampler()
 {
+    m_manager.m_resamplers.release(m_info.swr_key, m_info.swr_ctx);
+    m_info.swr_ctx = nullptr;
 }
 
-void audio_pipe_manager::set_mixer(audio_mixer& mixer)
+// Mixes out whatever swr is still holding on to and gives it back, so that
+// the stream can carry on without it.
+void audio_pipe_manager::audio_pipe::flush_resampler(bool contiguous,
+    uint64_t timestamp)
 {
-    m_mixer = &mixer;
+    m_info.compensation = 0;
+    if (!m_info.swr_ctx)
+        return;
+
+    drain_resampler(contiguous, timestamp);
+    release_resampler();
 }
 
-bool audio_pipe_manager::add(DWORD pid)
+// Mixes out whatever swr is still holding on to, and returns whether there
+// was anything, in which case swr needs swr_init() before it takes any more.
+// The leftover frames only belong on the timeline if the stream carries on
+// right where they end.
+bool audio_pipe_manager::audio_pipe::drain_resampler(bool contiguous,
+    uint64_t timestamp)
 {
-    if (contains(pid))
+    auto& swr_ctx = m_info.swr_ctx;
+
+    int delay = (int)swr_get_delay(swr_ctx, m_info.out_sample_rate);
+    if (delay <= 0)
         return false;
 
-    std::string name = AUDIO_PIPE_NAME + std::to_string(pid);
-    m_pipes[pid] = audio_pipe { name, m_mixer };
+    if (contiguous) {
+        uint32_t channels = get_audio_channels(m_info.out_speakers);
+        if (m_buffer.size() < (size_t)delay * channels)
+            m_buffer.resize((size_t)delay * channels);
+
+        uint8_t* flushed_data = (uint8_t*)m_buffer.data();
+        int flushed_frames = swr_convert(swr_ctx, &flushed_data, delay, NULL, 0);
+        if (flushed_frames > 0)
+            mix(m_buffer.data(), flushed_frames, channels, timestamp);
+    }
 
     return true;
 }
 
-void audio_pipe_manager::remove(DWORD pid)
+// Swaps the subscriber's input for one that fits the mixer's new blocks.
+// Anything still queued on the old one was worked out against the old epoch
+// and would only have been thrown away.
+void audio_pipe_manager::audio_pipe::resize_input(subscriber& sub)
 {
-    m_pipes.erase(pid);
+    sub.mixer->remove_input(sub.input);
+
+    // the mixer's done with it now, so its counts won't change anymore
+    count(m_stats.dropped_frames, sub.input->dropped_frames());
+    count(m_stats.rejected_frames, sub.input->rejected_frames());
+
+    sub.input = sub.mixer->add_input();
 }
 
-void audio_pipe_manager::clear()
+// Where the end of the stream so far lands on a subscriber's mixer. A mixer
+// that just subscribed or started over gets lined up with the stream using
+// the timestamp of the packet at hand.
+uint64_t audio_pipe_manager::audio_pipe::position_on(subscriber& sub,
+    uint64_t timestamp)
 {
-    for (auto& [pid, pipe] : m_pipes)
-        remove(pid);
+    auto& stream_position = m_info.stream_position;
+
+    uint64_t epoch = sub.mixer->epoch();
+    if (sub.epoch != epoch && sub.input->capacity() != sub.mixer->input_capacity())
+        resize_input(sub);
+
+    if (sub.epoch != epoch || sub.anchor != m_info.anchor) {
+        sub.offset = (int64_t)sub.mixer->calculate_position(timestamp)
+            - (int64_t)stream_position;
+        sub.epoch = epoch;
+        sub.anchor = m_info.anchor;
+    }
+
+    return (uint64_t)(sub.offset + (int64_t)stream_position);
 }
 
-bool audio_pipe_manager::contains(DWORD pid) const
+// Queues the samples at the end of the stream so far, on every subscribed
+// mixer. They only get mixed once the mixer pops.
+void audio_pipe_manager::audio_pipe::mix(const float* samples,
+    size_t frames_count, uint32_t channels, uint64_t timestamp)
 {
-    return m_pipes.find(pid) != m_pipes.end();
+    for (auto& sub : m_subscribers) {
+        uint64_t position = position_on(sub, timestamp);
+        if (!sub.input->push_frames(samples, frames_count, channels,
+                sub.epoch, position, m_info.trace))
+            count(m_stats.rejected_frames, frames_count);
+    }
+
+    m_info.stream_position += frames_count;
 }
 
-size_t audio_pipe_manager::size() const
+// Same as mix(), but straight from the received surround samples.
+void audio_pipe_manager::audio_pipe::downmix(const void* samples,
+    sample_format format, uint32_t channels, size_t frames_count,
+    uint64_t timestamp)
 {
-    return m_pipes.size();
+    for (auto& sub : m_subscribers) {
+        uint64_t position = position_on(sub, timestamp);
+        if (!sub.input->push_downmix(samples, format, channels, frames_count,
+                sub.epoch, position, m_info.trace))
+            count(m_stats.rejected_frames, frames_count);
+    }
+
+    m_info.stream_position += frames_count;
 }
 
-void audio_pipe_manager::target(const std::unordered_set<DWORD>& pids)
+//----------------------------------------------------------[ audio_pipe_manager
+
+// Reopens every pipe on the new transport.
+void audio_pipe_manager::set_transport(audio_transport transport)
 {
-    for (auto& pid : pids)
-        add(pid);
+    if (transport == m_transport)
+        return;
 
-    for (auto it = m_pipes.begin(); it != m_pipes.end();) {
-        const DWORD pid = it->first;
-        it++;
-        if (pids.find(pid) == pids.end())
-            remove(pid);
+    m_transport = transport;
+    for (auto& [pid, pipe] : m_pipes) {
+        std::vector<audio_mixer*> mixers = pipe->mixers();
+        pipe.reset();
+        pipe = std::make_unique<audio_pipe>(*this, pid, mixers);
     }
 }
 
-//--------------------------------------------[ application_manager::application
+audio_transport audio_pipe_manager::transport() const
+{
+    return m_transport;
+}
 
-const std::unordered_map<DWORD, bool>&
-application_manager::application::processes() const
+// The new pipe's receiver registers itself with m_io_loop, and unregisters
+// once remove() destroys it.
+bool audio_pipe_manager::add(uint32_t pid)
 {
-    return m_processes;
+    if (contains(pid))
+        return false;
+
+    m_pipes[pid] = std::make_unique<audio_pipe>(*this, pid,
+        std::vector<audio_mixer*> {});
+
+    return true;
 }
 
-const std::wstring& application_manager::application::display_name() const
+void audio_pipe_manager::remove(uint32_t pid)
 {
-    return m_display_name;
+    m_pipes.erase(pid);
 }
 
-bool application_manager::application::contains(DWORD pid) const
+audio_pipe_manager::~audio_pipe_manager()
 {
-    return m_processes.find(pid) != m_processes.end();
+    clear();
 }
 
-//---------------------------------------------------------[ application_manager
+// Also stops the io_loop, once no pipe is left on it.
+void audio_pipe_manager::clear()
+{
+    m_pipes.clear();
+    m_io_loop.stop();
+}
 
-template <typename T> static inline void safe_release(T** out_COM_obj)
+bool audio_pipe_manager::contains(uint32_t pid) const
 {
-    static_assert(std::is_base_of<IUnknown, T>::value,
-        "Object must implement IUnknown");
-    if (*out_COM_obj)
-        (*out_COM_obj)->Release();
-    *out_COM_obj = nullptr;
+    return m_pipes.find(pid) != m_pipes.end();
 }
 
-const std::unordered_map<std::string, application_manager::application>&
-application_manager::applications() const
+size_t audio_pipe_manager::size() const
 {
-    return m_applications;
+    return m_pipes.size();
 }
 
-void application_manager::add(const std::string& session_name,
-    const std::wstring& display_name, DWORD pid,
-    bool x64)
+void audio_pipe_manager::target(const std::unordered_set<uint32_t>& pids)
 {
-    if (m_applications.find(session_name) == m_applications.end()) {
-        m_applications[session_name] = {};
-        m_applications[session_name].m_display_name = display_name;
+    for (auto& pid : pids)
+        add(pid);
+
+    for (auto it = m_pipes.begin(); it != m_pipes.end();) {
+        const uint32_t pid = it->first;
+        it++;
+        if (pids.find(pid) == pids.end())
+            remove(pid);
     }
-    m_applications[session_name].m_processes[pid] = x64;
 }
 
-void application_manager::clear()
+void audio_pipe_manager::set_mixers(uint32_t pid,
+    const std::vector<audio_mixer*>& mixers)
 {
-    m_applications.clear();
+    auto it = m_pipes.find(pid);
+    if (it != m_pipes.end())
+        it->second->set_mixers(mixers);
 }
 
-bool application_manager::contains(std::string& session_name) const
+std::vector<audio_pipe_stats> audio_pipe_manager::stats(
+    const audio_mixer* mixer) const
 {
-    return m_applications.find(session_name) != m_applications.end();
+    std::vector<audio_pipe_stats> stats;
+    for (auto& [pid, pipe] : m_pipes) {
+        auto mixers = pipe->mixers();
+        if (std::find(mixers.begin(), mixers.end(), mixer) != mixers.end())
+            stats.push_back(pipe->stats());
+    }
+    return stats;
 }
 
-size_t application_manager::size() const
+void audio_pipe_manager::feed(uint32_t pid, uint8_t* buffer, size_t size)
 {
-    return m_applications.size();
+    auto it = m_pipes.find(pid);
+    if (it != m_pipes.end())
+        it->second->read(buffer, size);
 }
 
-bool application_manager::refresh()
+bool audio_pipe_manager::start_recording(const std::string& path)
 {
-    if (!SUCCEEDED(CoInitialize(NULL)))
-        return false;
-
-    bool success = false;
-    IMMDeviceEnumerator* device_enum = nullptr;
-    IMMDevice* device = nullptr;
-    IAudioSessionManager2* session_manager = nullptr;
-    IAudioSessionEnumerator* session_enum = nullptr;
-    IAudioSessionControl* session_control = nullptr;
-    IAudioSessionControl2* session_control2 = nullptr;
-
-    if (!SUCCEEDED(CoCreateInstance(
-            __uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
-            __uuidof(IMMDeviceEnumerator), (void**)&device_enum)))
-        goto out_uninitialize;
-
-    if (!SUCCEEDED(device_enum->GetDefaultAudioEndpoint(
-            eRender, eMultimedia, &device)))
-        goto out_release_device_enum;
-
-    if (!SUCCEEDED(device->Activate(__uuidof(IAudioSessionManager2), 0,
-            nullptr, (void**)&session_manager)))
-        goto out_release_device;
-
-    if (!SUCCEEDED(session_manager->GetSessionEnumerator(&session_enum)))
-        goto out_release_session_manager;
-
-    int session_count;
-    session_enum->GetCount(&session_count);
-    clear();
-    m_applications.reserve(session_count);
-
-    for (int i = 0; i < session_count; i++) {
-        if (!SUCCEEDED(session_enum->GetSession(i, &session_control)))
-            continue;
-
-        if (!SUCCEEDED(session_control->QueryInterface(
-                &session_control2))) {
-            safe_release(&session_control);
-            continue;
-        }
-
-        DWORD pid;
-        session_control2->GetProcessId(&pid);
-        HANDLE h_process = OpenProcess(PROCESS_ALL_ACCESS, FALSE, pid);
-
-        wchar_t* display_name;
-        session_control->GetDisplayName(&display_name);
-
-        char session_name[MAX_PATH];
-        DWORD session_name_len = GetModuleBaseNameA(
-            h_process, NULL, session_name, MAX_PATH);
-
-        if (session_name_len > 0) {
-            BOOL x32 = true;
-#ifdef _WIN64
-            IsWow64Process(h_process, &x32);
-#endif
-            add(session_name, display_name, pid, !x32);
-        }
+    return m_recorder.start(path);
+}
 
-        CloseHandle(h_process);
-        safe_release(&session_control2);
-        safe_release(&session_control);
-    }
-    success = true;
-
-    safe_release(&session_enum);
-out_release_session_manager:
-    safe_release(&session_manager);
-out_release_device:
-    safe_release(&device);
-out_release_device_enum:
-    safe_release(&device_enum);
-out_uninitialize:
-    CoUninitialize();
-    return success;
+void audio_pipe_manager::stop_recording()
+{
+    m_recorder.stop();
 }
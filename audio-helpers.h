@@ -1,8 +1,15 @@
 #pragma once
 #include "audio-hook-info.h"
-#include "win-pipe/win-pipe.h"
+#include "audio-kernels.h"
+#include "audio-transport.h"
+#include "drift-estimator.h"
+#include "latency-trace.h"
+#include "message-ring.h"
+#include "packet-recording.h"
 
-#include <deque>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -16,116 +23,367 @@ extern "C" {
 }
 #pragma warning(default : 4244)
 
-struct audio_frame {
-    float samples[AUDIO_RESAMPLE_CHANNELS];
-};
-
 int64_t obs_layout_to_swr_layout(enum speaker_layout layout);
 
 AVSampleFormat obs_format_to_swr_format(audio_format format);
 
-// Uses 1/NUM_VECS of its size to buffer the past, just in case of shenanigans.
-// The rest of its size, which is (NUM_VECS - 1)/NUM_VECS, is for buffering
-// the future.
+bool obs_format_to_sample_format(audio_format format, sample_format& out,
+    bool& planar);
+
+// Ring of NUM_BLOCKS preallocated blocks. The front block buffers the past,
+// just in case of shenanigans, and the other (NUM_BLOCKS - 1) blocks buffer
+// the future. Positions are absolute frame counts since the last resize, and
+// the mixer's only clock: timestamps are mapped to and from them with exact
+// integer math against the epoch, the time of position 0. Blocks hold
+// interleaved float samples in whatever format OBS outputs.
+//
+// Streams never touch the blocks themselves. Each one pushes its packets into
+// its own input, and whichever thread pops drains every input into the blocks
+// in one go, so the blocks only ever belong to that one thread. Only inputs,
+// the calculate_* functions, epoch() and the format getters are safe to use
+// from any other thread.
 class audio_mixer {
+public:
+    // Front block lent out by pop(). It stays valid until it is handed back
+    // with release().
+    struct block_view {
+        const float* samples = nullptr;
+        size_t size = 0;
+        int sample_rate = 0;
+        speaker_layout speakers = SPEAKERS_UNKNOWN;
+        uint64_t position = 0;
+        uint64_t timestamp = 0;
+
+        // packets that made it into the block while tracing, see
+        // latency-trace.h
+        const uint64_t* traces = nullptr;
+        size_t traces_count = 0;
+    };
+
+    // One stream's packets on their way into the mixer, in a wait-free
+    // single-producer/single-consumer ring. Positions are tagged with the
+    // epoch they were worked out against, so that anything queued before a
+    // resize gets thrown away rather than mixed in at the wrong place.
+    class input {
+        friend class audio_mixer;
+
+    public:
+        input(size_t capacity);
+        input(const input&) = delete;
+
+        input& operator=(const input&) = delete;
+
+        bool push_frames(const float* samples, size_t frames_count,
+            uint32_t channels, uint64_t epoch, uint64_t position,
+            uint64_t trace);
+        bool push_downmix(const void* samples, sample_format format,
+            uint32_t channels, size_t frames_count, uint64_t epoch,
+            uint64_t position, uint64_t trace);
+
+        size_t capacity() const;
+
+        // Frames the mixer threw away for landing outside its blocks, too
+        // late or too early, and for having been queued against an earlier
+        // epoch.
+        uint64_t dropped_frames() const;
+        uint64_t rejected_frames() const;
+
+    private:
+        struct alignas(64) cache_line {
+            uint8_t bytes[64];
+        };
+
+        std::vector<cache_line> m_memory;
+        message_ring m_ring;
+        size_t m_capacity;
+
+        // only ever written by the mixer's thread
+        std::atomic<uint64_t> m_dropped_frames = 0;
+        std::atomic<uint64_t> m_rejected_frames = 0;
+    };
+
 public:
     audio_mixer(size_t size = 0);
 
-    size_t calculate_index(uint64_t timestamp) const;
-    static size_t calculate_size(uint64_t duration);
-    uint64_t calculate_timestamp(size_t index) const;
-    static uint64_t calculate_duration(size_t size);
+    uint64_t calculate_position(uint64_t timestamp) const;
+    size_t calculate_size(uint64_t duration) const;
+    uint64_t calculate_timestamp(uint64_t position) const;
+    uint64_t calculate_duration(uint64_t size) const;
 
     void resize(size_t size);
     size_t size() const;
+    void set_format(int sample_rate, speaker_layout speakers);
+    int sample_rate() const;
+    speaker_layout speakers() const;
     bool ready_to_pop() const;
+    uint64_t pop_deadline() const;
     uint64_t timestamp() const;
-    std::vector<audio_frame> pop();
-    void mix_frames(const audio_frame* frames_buffer, size_t frames_count,
-        size_t index);
-    void mix_frames(const std::vector<audio_frame>& frames, size_t index);
+    uint64_t epoch() const;
+    block_view pop();
+    void release(const block_view& view);
+    size_t input_capacity() const;
+    std::shared_ptr<input> add_input();
+    void remove_input(const std::shared_ptr<input>& in);
 
 public:
-    static constexpr int NUM_VECS = 3;
+    static constexpr int NUM_BLOCKS = 3;
+
+    // inputs hold NUM_BLOCKS blocks' worth of the widest packets, 7.1
+    // before it's downmixed, and never less than this, packets that don't
+    // fit between two pops get dropped
+    static constexpr size_t MIN_INPUT_CAPACITY = 1 << 16;
+
+    // traces a block keeps, reserved up front so that tagging one never
+    // allocates while mixing. Any past this go unrecorded at the output.
+    static constexpr size_t MAX_BLOCK_TRACES = 256;
 
 private:
-    std::deque<std::vector<audio_frame>> m_vecs;
-    uint64_t m_timestamp;
-    size_t m_size;
-    std::mutex m_mutex;
+    struct block {
+        uint64_t position = 0;
+        size_t size = 0;
+        uint32_t channels = 0;
+        std::vector<float> samples;
+        std::vector<uint64_t> traces;
+    };
+
+    void reset(size_t block_size, int sample_rate, speaker_layout speakers);
+    void drain();
+    void mix_packet(const uint8_t* packet, size_t size);
+    template <typename F>
+    size_t for_each_span(size_t frames_count, uint32_t channels,
+        uint64_t position, uint64_t trace, F&& func);
+    block& block_at(uint64_t position, size_t block_size);
+
+    std::array<block, NUM_BLOCKS> m_blocks;
+    uint64_t m_position = 0;
+    size_t m_block_size = 0;
+    std::atomic<uint64_t> m_epoch = 0;
+    std::atomic<size_t> m_input_capacity = MIN_INPUT_CAPACITY;
+    std::atomic<int> m_sample_rate = AUDIO_RESAMPLE_DEFAULT_RATE;
+    std::atomic<speaker_layout> m_speakers = AUDIO_RESAMPLE_DEFAULT_SPEAKERS;
+
+    // only held to add or remove inputs, and while draining them
+    std::mutex m_inputs_mutex;
+    std::vector<std::shared_ptr<input>> m_inputs;
+    message_ring::callback_t m_mix_packet;
+
+    // whichever input drain() is reading right now
+    input* m_draining = nullptr;
+};
+
+// Idle resamplers, initialized and ready to go, by the formats they convert
+// between. A stream takes one whenever it needs swr and gives it back once it
+// stops needing it, so streams that switch formats back and forth, or many
+// processes of one app in the same format, never build another one. Safe to
+// share between threads.
+class resampler_pool {
+public:
+    struct key {
+        int64_t in_layout = 0;
+        AVSampleFormat in_format = AV_SAMPLE_FMT_NONE;
+        int in_rate = 0;
+        int64_t out_layout = 0;
+        int out_rate = 0;
+
+        bool operator==(const key&) const = default;
+    };
+
+public:
+    resampler_pool() = default;
+    resampler_pool(const resampler_pool&) = delete;
+    ~resampler_pool();
+
+    resampler_pool& operator=(const resampler_pool&) = delete;
+
+    // Returns nullptr if swr couldn't make sense of the formats.
+    SwrContext* acquire(const key& k);
+
+    // Starts ctx over clean, dropping anything it was still holding on to,
+    // before it can be handed out again.
+    void release(const key& k, SwrContext* ctx);
+
+    size_t idle() const;
+
+public:
+    // beyond this many, released resamplers get freed instead
+    static constexpr size_t MAX_IDLE = 32;
+
+private:
+    struct key_hash {
+        size_t operator()(const key& k) const;
+    };
+
+    mutable std::mutex m_mutex;
+    std::unordered_multimap<key, SwrContext*, key_hash> m_idle;
+};
+
+// What one pipe has received since it was added, and what became of it.
+// Snapshotted from counters that get written without any locking, so the
+// numbers can be a packet apart from each other.
+struct audio_pipe_stats {
+    uint32_t pid = 0;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t frames = 0;
+    uint64_t format_changes = 0;
+
+    // packets snapped onto the end of the previous one, and packets that
+    // started the stream's timeline over
+    uint64_t contiguous = 0;
+    uint64_t discontiguous = 0;
+
+    // frames the mixers threw away for landing outside their blocks, summed
+    // over every mixer, and frames that never made it onto a mixer at all,
+    // because its input was full or they were queued before it last resized
+    uint64_t dropped_frames = 0;
+    uint64_t rejected_frames = 0;
 };
 
 class audio_pipe_manager {
 private:
+    // Lives at a fixed address, since its receiver calls back into it from
+    // the io_loop's thread for as long as it exists. Each packet is converted
+    // once and then queued on every subscribed mixer.
     class audio_pipe {
         friend class audio_pipe_manager;
 
     public:
-        audio_pipe() = default;
-        audio_pipe(std::string_view name, audio_mixer* mixer);
-        audio_pipe(audio_pipe&& other) noexcept;
+        audio_pipe(audio_pipe_manager& manager, uint32_t pid,
+            const std::vector<audio_mixer*>& mixers);
+        audio_pipe(const audio_pipe&) = delete;
         ~audio_pipe();
 
-        audio_pipe& operator=(audio_pipe&& other) noexcept;
+        audio_pipe& operator=(const audio_pipe&) = delete;
 
+        void set_mixers(const std::vector<audio_mixer*>& mixers);
+        std::vector<audio_mixer*> mixers() const;
+        audio_pipe_stats stats() const;
         void read(uint8_t* buffer, size_t size);
 
     private:
-        win_pipe::receiver m_receiver;
+        bool acquire_resampler();
+        void release_resampler();
+        void flush_resampler(bool contiguous, uint64_t timestamp);
+        bool drain_resampler(bool contiguous, uint64_t timestamp);
+        void mix(const float* samples, size_t frames_count, uint32_t channels,
+            uint64_t timestamp);
+        void downmix(const void* samples, sample_format format,
+            uint32_t channels, size_t frames_count, uint64_t timestamp);
 
-        struct {
+    public:
+        // Packets stamped within this much of where the previous one ended
+        // are treated as contiguous. Timestamps come from the hook, so this
+        // only has to cover the app's own submission jitter.
+        static constexpr uint64_t TIMESTAMP_EPSILON = 20'000'000;
+
+        // Streams at the mixer's rate and layout skip swr until their
+        // estimated drift grows past the first, and go back to skipping it
+        // once compensation has pulled them back under the second.
+        static constexpr uint64_t PASSTHROUGH_MAX_DRIFT = 2'000'000;
+        static constexpr uint64_t PASSTHROUGH_RESUME_DRIFT = 100'000;
+
+    private:
+        // Where the stream's own timeline lands on one mixer's. Taken again
+        // whenever either side starts over, which keeps contiguous packets
+        // sample-exact on every mixer without them sharing an epoch.
+        struct subscriber {
             audio_mixer* mixer = nullptr;
+            std::shared_ptr<audio_mixer::input> input;
+            uint64_t epoch = 0;
+            uint64_t anchor = 0;
+            int64_t offset = 0;
+        };
+
+        uint64_t position_on(subscriber& sub, uint64_t timestamp);
+        void resize_input(subscriber& sub);
+
+        // for the io_loop, resampler_pool and packet_recorder it shares
+        // with every other pipe
+        audio_pipe_manager& m_manager;
+        uint32_t m_pid;
+
+        struct {
             SwrContext* swr_ctx = nullptr;
+            resampler_pool::key swr_key;
             int64_t layout = 0;
             AVSampleFormat format = AV_SAMPLE_FMT_NONE;
             int sample_rate = 0;
-            uint64_t last_timestamp = 0;
+            int out_sample_rate = 0;
+            speaker_layout out_speakers = SPEAKERS_UNKNOWN;
+            uint64_t anchor_timestamp = 0;
+            uint64_t anchor = 0;
+            uint64_t stream_position = 0;
+            int compensation = 0;
+            uint64_t trace = 0;
+            uint32_t trace_sequence = 0;
+            bool passthrough = false;
+            bool warned_version = false;
         } m_info;
-    };
 
-public:
-    audio_pipe_manager() = default;
-    audio_pipe_manager(audio_mixer& mixer);
+        drift_estimator m_drift;
 
-    void set_mixer(audio_mixer& mixer);
-    bool add(DWORD pid);
-    void remove(DWORD pid);
-    void clear();
-    bool contains(DWORD pid) const;
-    size_t size() const;
-    void target(const std::unordered_set<DWORD>& pids);
+        // only ever written by whichever thread reads, see count()
+        struct {
+            std::atomic<uint64_t> packets = 0;
+            std::atomic<uint64_t> bytes = 0;
+            std::atomic<uint64_t> frames = 0;
+            std::atomic<uint64_t> format_changes = 0;
+            std::atomic<uint64_t> contiguous = 0;
+            std::atomic<uint64_t> discontiguous = 0;
+            std::atomic<uint64_t> rejected_frames = 0;
 
-private:
-    std::unordered_map<DWORD, audio_pipe> m_pipes;
-    audio_mixer* m_mixer = nullptr;
-};
+            // of inputs that have since been swapped out
+            std::atomic<uint64_t> dropped_frames = 0;
+        } m_stats;
 
-class application_manager {
-public:
-    class application {
-        friend class application_manager;
+        // only ever grows, to fit the largest packet seen so far
+        std::vector<float> m_buffer;
 
-    public:
-        const std::unordered_map<DWORD, bool>& processes() const;
-        const std::wstring& display_name() const;
-        bool contains(DWORD pid) const;
+        // held for all of read(), so that a mixer is never written to once
+        // it has been unsubscribed
+        mutable std::mutex m_subscribers_mutex;
+        std::vector<subscriber> m_subscribers;
 
-    private:
-        std::unordered_map<DWORD, bool> m_processes;
-        std::wstring m_display_name;
+        // last, so it's started after and stopped before everything read uses
+        std::unique_ptr<audio_receiver> m_receiver;
     };
 
 public:
-    application_manager() = default;
+    audio_pipe_manager() = default;
+    ~audio_pipe_manager();
 
-    const std::unordered_map<std::string, application>& applications() const;
-    void add(const std::string& session_name, const std::wstring& display_name,
-        DWORD pid, bool x64);
+    void set_transport(audio_transport transport);
+    audio_transport transport() const;
+    bool add(uint32_t pid);
+    void remove(uint32_t pid);
     void clear();
-    bool contains(std::string& session_name) const;
+    bool contains(uint32_t pid) const;
     size_t size() const;
-    bool refresh();
+    void target(const std::unordered_set<uint32_t>& pids);
+    void set_mixers(uint32_t pid, const std::vector<audio_mixer*>& mixers);
+
+    // Of every pipe that mixes into mixer.
+    std::vector<audio_pipe_stats> stats(const audio_mixer* mixer) const;
+
+    // Runs a packet through pid's pipe as if its receiver had just received
+    // it. Only for pipes on audio_transport::none, anything else would race
+    // with the receiver.
+    void feed(uint32_t pid, uint8_t* buffer, size_t size);
+
+    // Records every packet any pipe receives from now on, see
+    // packet-recording.h.
+    bool start_recording(const std::string& path);
+    void stop_recording();
 
 private:
-    std::unordered_map<std::string, application> m_applications;
+    // every pipe is read on this one thread, so it has to outlive them all
+    io_loop m_io_loop;
+
+    // same goes for where the pipes' resamplers go back to, and for what
+    // they record to
+    resampler_pool m_resamplers;
+    packet_recorder m_recorder;
+
+    std::unordered_map<uint32_t, std::unique_ptr<audio_pipe>> m_pipes;
+    audio_transport m_transport = audio_transport::pipe;
 };
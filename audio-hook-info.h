@@ -4,25 +4,36 @@
 
 // clang-format off
 
-#define AUDIO_PIPE_NAME                 "AudioHook_Pipe"
+// bump whenever audio_metadata changes, hooks from older builds can still be
+// sitting inside running apps
+#define AUDIO_PROTOCOL_MAGIC            0x4F414148 // "HAAO"
+#define AUDIO_PROTOCOL_VERSION          2
 
-#define AUDIO_RESAMPLE_CHANNELS         2
-#define AUDIO_RESAMPLE_SAMPLE_SIZE      sizeof(float)
-#define AUDIO_RESAMPLE_FRAME_SIZE       (AUDIO_RESAMPLE_CHANNELS * AUDIO_RESAMPLE_SAMPLE_SIZE)
+// audio_metadata::flags
+#define AUDIO_METADATA_SILENT           0x1
 
-#define AUDIO_RESAMPLE_SPEAKERS         SPEAKERS_STEREO
 #define AUDIO_RESAMPLE_AUDIO_FORMAT     AUDIO_FORMAT_FLOAT
-#define AUDIO_RESAMPLE_SAMPLE_RATE      44100
-
-#define AUDIO_RESAMPLE_AV_CH_LAYOUT     AV_CH_LAYOUT_STEREO
 #define AUDIO_RESAMPLE_AV_SAMPLE_FMT    AV_SAMPLE_FMT_FLT
 
+// only until OBS's own output format is known
+#define AUDIO_RESAMPLE_DEFAULT_SPEAKERS SPEAKERS_STEREO
+#define AUDIO_RESAMPLE_DEFAULT_RATE     48000
 
 // clang-format on
 
 struct audio_metadata {
+    uint32_t magic;
+    uint32_t version;
+
+    // taken in ReleaseBuffer, same clock as os_gettime_ns()
+    uint64_t timestamp;
+
     speaker_layout layout;
     audio_format format;
     int samples_per_sec;
     uint32_t frames;
+
+    // with AUDIO_METADATA_SILENT no samples follow, the packet just stands in
+    // for that many frames of silence
+    uint32_t flags;
 };
@@ -1,6 +1,10 @@
 #include "audio-hook-info.h"
-#include "win-pipe/win-pipe.h"
+#include "audio-transport.h"
+#include "message-ring.h"
 
+#include <atomic>
+#include <memory>
+#include <string.h>
 #include <string>
 
 #include <audioclient.h>
@@ -12,7 +16,49 @@
 
 #include <media-io/audio-io.h>
 
-win_pipe::sender g_sender;
+// clang-format off
+
+// threads the app can render audio on at once before packets get dropped,
+// each with room for roughly a third of a second of 7.1 float at 48kHz
+#define STAGING_RINGS 4
+#define STAGING_SIZE (1 << 19)
+#define STAGING_WAIT_TIMEOUT_MS 100
+
+// how long unhooking waits for the sender and any writers to let go of the
+// staging rings
+#define SENDER_STOP_TIMEOUT_MS 1000
+
+// clang-format on
+
+// Only ever touched by the sender thread. The app's audio threads just copy
+// into g_staging and move on, so a slow or reconnecting transport can never
+// make them miss their deadlines.
+std::unique_ptr<audio_sender> g_sender;
+
+// A ring only takes one writer, so every thread the app renders audio on
+// takes one of its own the first time it stages a packet, and keeps it until
+// it exits. Nothing on the way into them ever waits on another thread.
+void* g_staging_memory = nullptr;
+message_ring g_staging[STAGING_RINGS];
+std::atomic<bool> g_staging_taken[STAGING_RINGS] = {};
+HANDLE g_staging_event = NULL;
+HANDLE g_sender_thread = NULL;
+HANDLE g_sender_done = NULL;
+std::atomic<bool> g_stopping = false;
+
+// release_buffer_hooks in the middle of staging a packet, which stop_sender()
+// waits out before it frees the rings
+std::atomic<uint32_t> g_staging_writers = 0;
+
+struct staging_slot {
+    int index = -1;
+
+    ~staging_slot()
+    {
+        if (index >= 0)
+            g_staging_taken[index].store(false, std::memory_order_release);
+    }
+};
 
 // clang-format off
 
@@ -28,14 +74,167 @@ HRESULT (WINAPI* g_original_initialize)(IUnknown*, AUDCLNT_SHAREMODE, DWORD,
 IAudioRenderClient* g_audio_render_client = nullptr;
 IAudioClient* g_audio_client = nullptr;
 WAVEFORMATEX* g_wave_format = nullptr;
-BYTE* g_data = nullptr;
 
-void init_pipe()
+// GetBuffer and ReleaseBuffer come in pairs on whichever thread is rendering,
+// and an app can have several of those going at once
+thread_local BYTE* t_data = nullptr;
+thread_local staging_slot t_staging;
+
+// The calling thread's ring, or nullptr if every one of them is taken.
+message_ring* staging_ring()
+{
+    if (t_staging.index < 0) {
+        for (int i = 0; i < STAGING_RINGS; i++) {
+            if (!g_staging_taken[i].exchange(true, std::memory_order_acquire)) {
+                t_staging.index = i;
+                break;
+            }
+        }
+    }
+
+    return t_staging.index >= 0 ? &g_staging[t_staging.index] : nullptr;
+}
+
+// Only goes to sleep if every ring is marked, so that a write to any of them
+// wakes the sender back up.
+bool prepare_staging_sleep()
+{
+    for (int i = 0; i < STAGING_RINGS; i++) {
+        if (!g_staging[i].prepare_sleep()) {
+            for (int j = 0; j < i; j++)
+                g_staging[j].finish_sleep();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void finish_staging_sleep()
+{
+    for (message_ring& ring : g_staging)
+        ring.finish_sleep();
+}
+
+DWORD WINAPI sender_thread(LPVOID)
 {
-    std::string name = AUDIO_PIPE_NAME;
-    name += std::to_string(GetCurrentProcessId());
+    // whichever transport the plugin happens to be listening on
+    g_sender = create_audio_sender(audio_transport::automatic,
+        GetCurrentProcessId());
 
-    g_sender = win_pipe::sender(name);
+    message_ring::callback_t send = [](uint8_t* data, size_t size) {
+        g_sender->send(data, size, nullptr, 0);
+    };
+
+    while (!g_stopping) {
+        size_t count = 0;
+        for (message_ring& ring : g_staging)
+            count += ring.read(send);
+
+        if (count || !prepare_staging_sleep())
+            continue;
+
+        WaitForSingleObject(g_staging_event, STAGING_WAIT_TIMEOUT_MS);
+        finish_staging_sleep();
+    }
+
+    // nothing of the rings' gets touched after this, stop_sender() frees them
+    g_sender.reset();
+    SetEvent(g_sender_done);
+    return 0;
+}
+
+bool start_sender()
+{
+    size_t ring_size = message_ring::required_size(STAGING_SIZE);
+    size_t size = ring_size * STAGING_RINGS;
+    g_staging_memory = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE,
+        PAGE_READWRITE);
+    if (!g_staging_memory)
+        return false;
+
+    // fault every page in now rather than on the app's audio threads
+    memset(g_staging_memory, 0, size);
+    for (int i = 0; i < STAGING_RINGS; i++)
+        g_staging[i].init((uint8_t*)g_staging_memory + i * ring_size,
+            STAGING_SIZE);
+
+    g_staging_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    g_sender_done = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!g_staging_event || !g_sender_done)
+        return false;
+
+    g_sender_thread = CreateThread(NULL, 0, sender_thread, NULL, 0, NULL);
+    return g_sender_thread != NULL;
+}
+
+// Called from DllMain, so the thread can't be joined on its handle when the
+// DLL is being unloaded, since exiting takes the loader lock held here. It
+// signals g_sender_done once it's let go of the rings instead. When the whole
+// process is exiting it's already gone, and its handle is signalled.
+void stop_sender()
+{
+    ULONGLONG deadline = GetTickCount64() + SENDER_STOP_TIMEOUT_MS;
+    g_stopping = true;
+
+    // Whichever writers got in before g_stopping are only ever a copy away
+    // from done. Pairs with the increment in release_buffer_hook, so that
+    // either it sees g_stopping or this sees it writing.
+    bool stopped = true;
+    while (g_staging_writers.load() != 0) {
+        if (GetTickCount64() > deadline) {
+            stopped = false;
+            break;
+        }
+        SwitchToThread();
+    }
+
+    if (g_sender_thread) {
+        SetEvent(g_staging_event);
+
+        ULONGLONG now = GetTickCount64();
+        DWORD timeout = now < deadline ? (DWORD)(deadline - now) : 0;
+
+        HANDLE handles[] = { g_sender_done, g_sender_thread };
+        DWORD result = WaitForMultipleObjects(2, handles, FALSE, timeout);
+        stopped = stopped && result != WAIT_TIMEOUT;
+
+        CloseHandle(g_sender_thread);
+        g_sender_thread = NULL;
+    }
+
+    // stuck sending or writing, better to leak the rings than to pull them
+    // out from under it
+    if (!stopped)
+        return;
+
+    if (g_staging_memory)
+        VirtualFree(g_staging_memory, 0, MEM_RELEASE);
+    g_staging_memory = nullptr;
+
+    if (g_staging_event)
+        CloseHandle(g_staging_event);
+    if (g_sender_done)
+        CloseHandle(g_sender_done);
+    g_staging_event = NULL;
+    g_sender_done = NULL;
+}
+
+// Same clock as os_gettime_ns(), which can't be used here because libobs
+// isn't loaded into the hooked process.
+uint64_t get_time_ns()
+{
+    static LARGE_INTEGER frequency = {};
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    // split up so that multiplying by 1e9 doesn't overflow
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1'000'000'000 + remainder * 1'000'000'000 / frequency.QuadPart;
 }
 
 template <typename T> inline void safe_release(T** out_COM_obj)
@@ -73,23 +272,32 @@ HRESULT WINAPI get_buffer_hook(IUnknown* This, UINT32 NumFramesRequested,
     BYTE** ppData)
 {
     HRESULT ret = g_original_get_buffer(This, NumFramesRequested, ppData);
-    g_data = *ppData;
+    t_data = *ppData;
     return ret;
 }
 
 HRESULT WINAPI release_buffer_hook(IUnknown* This, UINT32 NumFramesWritten,
     DWORD dwFlags)
 {
+    uint64_t timestamp = get_time_ns();
+
     HRESULT ret = g_original_release_buffer(This, NumFramesWritten, dwFlags);
-    if (NumFramesWritten == 0)
+    if (NumFramesWritten == 0 || !g_sender_thread)
         return ret;
 
-    size_t data_size = (size_t)NumFramesWritten * g_wave_format->nBlockAlign;
-    size_t buffer_size = data_size + sizeof(audio_metadata);
+    audio_metadata metadata = {};
+    audio_metadata* md = &metadata;
 
-    std::vector<uint8_t> buffer(buffer_size, 0);
-    audio_metadata* md = reinterpret_cast<audio_metadata*>(buffer.data());
-    uint8_t* data = reinterpret_cast<uint8_t*>(md + 1);
+    md->magic = AUDIO_PROTOCOL_MAGIC;
+    md->version = AUDIO_PROTOCOL_VERSION;
+    md->timestamp = timestamp;
+
+    // whatever is in the buffer is meaningless, only the gap gets shipped
+    size_t data_size = (size_t)NumFramesWritten * g_wave_format->nBlockAlign;
+    if (dwFlags & AUDCLNT_BUFFERFLAGS_SILENT) {
+        md->flags |= AUDIO_METADATA_SILENT;
+        data_size = 0;
+    }
 
     if (g_wave_format->cbSize < 22) {
         if (g_wave_format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
@@ -147,9 +355,20 @@ HRESULT WINAPI release_buffer_hook(IUnknown* This, UINT32 NumFramesWritten,
 
     md->samples_per_sec = g_wave_format->nSamplesPerSec;
     md->frames = NumFramesWritten;
-    
-    memcpy(data, g_data, data_size);
-    g_sender.send(buffer.data(), buffer_size);
+
+    // counted, so that stop_sender() knows when it's safe to free the rings
+    g_staging_writers.fetch_add(1);
+    if (!g_stopping.load()) {
+        // if the sender has fallen this far behind, or every ring is taken,
+        // the packet is lost anyway
+        bool needs_wake = false;
+        if (message_ring* ring = staging_ring())
+            ring->write((const uint8_t*)md, sizeof(*md), t_data, data_size,
+                needs_wake);
+        if (needs_wake)
+            SetEvent(g_staging_event);
+    }
+    g_staging_writers.fetch_sub(1, std::memory_order_release);
 
     return ret;
 }
@@ -199,6 +418,9 @@ bool core_audio_hook()
             (void**)&g_audio_render_client)))
         goto out_release_device;
 
+    if (!start_sender())
+        goto out_release_device;
+
     success = true;
     hook_COM(g_audio_render_client, &get_buffer_hook,
         (void**)&g_original_get_buffer, 3);
@@ -206,7 +428,6 @@ bool core_audio_hook()
         (void**)&g_original_release_buffer, 4);
     hook_COM(g_audio_client, *initialize_hook,
         (void**)&g_original_initialize, 3);
-    init_pipe();
 
 out_release_device:
     safe_release(&device);
@@ -221,6 +442,7 @@ void core_audio_unhook()
 {
     hook_COM(g_audio_render_client, g_original_get_buffer, nullptr, 3);
     hook_COM(g_audio_render_client, g_original_release_buffer, nullptr, 4);
+    stop_sender();
     if (SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED))) {
         safe_release(&g_audio_render_client);
         safe_release(&g_audio_client);
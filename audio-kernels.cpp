@@ -0,0 +1,553 @@
+#include "audio-kernels.h"
+
+#include <string.h>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// msvc lets any intrinsic through regardless of /arch, gcc and clang need to
+// be told per function
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// same scale factors as libswresample, so the results match it exactly
+#define SCALE_U8 (1.0f / (1 << 7))
+#define SCALE_S16 (1.0f / (1 << 15))
+#define SCALE_S32 (1.0f / (1U << 31))
+
+// frames converted at a time when deinterleaving planar input, small enough
+// to stay on the stack and in L1
+#define PLANAR_CHUNK 256
+
+struct kernel_table {
+    const char* name;
+    void (*mix)(float* dst, const float* src, size_t count);
+    void (*convert_u8)(float* dst, const uint8_t* src, size_t count);
+    void (*convert_s16)(float* dst, const int16_t* src, size_t count);
+    void (*convert_s32)(float* dst, const int32_t* src, size_t count);
+    void (*interleave2)(float* dst, const float* left, const float* right,
+        size_t count);
+};
+
+//----------------------------------------------------------------------[ scalar
+
+static void mix_samples_scalar(float* dst, const float* src, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        dst[i] += src[i];
+}
+
+static void convert_u8_scalar(float* dst, const uint8_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        dst[i] = ((int)src[i] - 0x80) * SCALE_U8;
+}
+
+static void convert_s16_scalar(float* dst, const int16_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        dst[i] = src[i] * SCALE_S16;
+}
+
+static void convert_s32_scalar(float* dst, const int32_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        dst[i] = src[i] * SCALE_S32;
+}
+
+static void interleave2_scalar(float* dst, const float* left,
+    const float* right, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 2] = left[i];
+        dst[i * 2 + 1] = right[i];
+    }
+}
+
+//-------------------------------------------------------------------------[ x86
+
+#ifdef KERNELS_X86
+
+TARGET_SSE2 static void mix_samples_sse2(float* dst, const float* src,
+    size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_loadu_ps(src + i + 4));
+        _mm_storeu_ps(dst + i, a);
+        _mm_storeu_ps(dst + i + 4, b);
+    }
+    for (; i < count; i++)
+        dst[i] += src[i];
+}
+
+// zero extended to 16 bits and recentred, then sign extended to 32
+TARGET_SSE2 static void convert_u8_sse2(float* dst, const uint8_t* src,
+    size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(0x80);
+    const __m128 scale = _mm_set1_ps(SCALE_U8);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), bias);
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), bias);
+
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+        __m128i c = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+        __m128i d = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+        _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(c), scale));
+        _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(d), scale));
+    }
+    convert_u8_scalar(dst + i, src + i, count - i);
+}
+
+TARGET_SSE2 static void convert_s16_sse2(float* dst, const int16_t* src,
+    size_t count)
+{
+    const __m128 scale = _mm_set1_ps(SCALE_S16);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+    }
+    convert_s16_scalar(dst + i, src + i, count - i);
+}
+
+TARGET_SSE2 static void convert_s32_sse2(float* dst, const int32_t* src,
+    size_t count)
+{
+    const __m128 scale = _mm_set1_ps(SCALE_S32);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+    }
+    convert_s32_scalar(dst + i, src + i, count - i);
+}
+
+TARGET_SSE2 static void interleave2_sse2(float* dst, const float* left,
+    const float* right, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+
+        _mm_storeu_ps(dst + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+    interleave2_scalar(dst + i * 2, left + i, right + i, count - i);
+}
+
+TARGET_AVX2 static void mix_samples_avx2(float* dst, const float* src,
+    size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i));
+        __m256 b = _mm256_add_ps(_mm256_loadu_ps(dst + i + 8), _mm256_loadu_ps(src + i + 8));
+        _mm256_storeu_ps(dst + i, a);
+        _mm256_storeu_ps(dst + i + 8, b);
+    }
+    for (; i < count; i++)
+        dst[i] += src[i];
+}
+
+TARGET_AVX2 static void convert_u8_avx2(float* dst, const uint8_t* src,
+    size_t count)
+{
+    const __m256i bias = _mm256_set1_epi32(0x80);
+    const __m256 scale = _mm256_set1_ps(SCALE_U8);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+        __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i + 8)));
+
+        a = _mm256_sub_epi32(a, bias);
+        b = _mm256_sub_epi32(b, bias);
+
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+    }
+    convert_u8_scalar(dst + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void convert_s16_avx2(float* dst, const int16_t* src,
+    size_t count)
+{
+    const __m256 scale = _mm256_set1_ps(SCALE_S16);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+    }
+    convert_s16_scalar(dst + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void convert_s32_avx2(float* dst, const int32_t* src,
+    size_t count)
+{
+    const __m256 scale = _mm256_set1_ps(SCALE_S32);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 8));
+
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+    }
+    convert_s32_scalar(dst + i, src + i, count - i);
+}
+
+static void cpuid(int leaf, int info[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, 0);
+#else
+    __asm__ __volatile__("cpuid"
+                         : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3])
+                         : "a"(leaf), "c"(0));
+#endif
+}
+
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv"
+                         : "=a"(lo), "=d"(hi)
+                         : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static bool cpu_has_sse2()
+{
+    int info[4];
+    cpuid(1, info);
+    return info[3] & (1 << 26);
+}
+
+static bool cpu_has_avx2()
+{
+    int info[4];
+    cpuid(0, info);
+    if (info[0] < 7)
+        return false;
+
+    // the os also has to save ymm registers on context switches
+    cpuid(1, info);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (xgetbv0() & 0x6) != 0x6)
+        return false;
+
+    cpuid(7, info);
+    return info[1] & (1 << 5);
+}
+
+#endif
+
+//------------------------------------------------------------------------[ neon
+
+#ifdef KERNELS_NEON
+
+static void mix_samples_neon(float* dst, const float* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i));
+        float32x4_t b = vaddq_f32(vld1q_f32(dst + i + 4), vld1q_f32(src + i + 4));
+        vst1q_f32(dst + i, a);
+        vst1q_f32(dst + i + 4, b);
+    }
+    for (; i < count; i++)
+        dst[i] += src[i];
+}
+
+static void convert_u8_neon(float* dst, const uint8_t* src, size_t count)
+{
+    const int16x8_t bias = vdupq_n_s16(0x80);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src + i))), bias);
+
+        float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+        float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        vst1q_f32(dst + i, vmulq_n_f32(a, SCALE_U8));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(b, SCALE_U8));
+    }
+    convert_u8_scalar(dst + i, src + i, count - i);
+}
+
+static void convert_s16_neon(float* dst, const int16_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+
+        float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+        float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        vst1q_f32(dst + i, vmulq_n_f32(a, SCALE_S16));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(b, SCALE_S16));
+    }
+    convert_s16_scalar(dst + i, src + i, count - i);
+}
+
+static void convert_s32_neon(float* dst, const int32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = vcvtq_f32_s32(vld1q_s32(src + i));
+        float32x4_t b = vcvtq_f32_s32(vld1q_s32(src + i + 4));
+        vst1q_f32(dst + i, vmulq_n_f32(a, SCALE_S32));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(b, SCALE_S32));
+    }
+    convert_s32_scalar(dst + i, src + i, count - i);
+}
+
+static void interleave2_neon(float* dst, const float* left,
+    const float* right, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4x2_t lr = { { vld1q_f32(left + i), vld1q_f32(right + i) } };
+        vst2q_f32(dst + i * 2, lr);
+    }
+    interleave2_scalar(dst + i * 2, left + i, right + i, count - i);
+}
+
+#endif
+
+//---------------------------------------------------------------------[ downmix
+
+// Center and surrounds come in at -3dB and LFE is dropped, same as the
+// matrix swr builds by default for float output.
+#define DOWNMIX_C 0.70710678f
+
+template <uint32_t CHANNELS> struct downmix_matrix;
+
+// FL FR FC LFE SL SR
+template <> struct downmix_matrix<6> {
+    static constexpr float left[6] = { 1.0f, 0.0f, DOWNMIX_C, 0.0f, DOWNMIX_C, 0.0f };
+    static constexpr float right[6] = { 0.0f, 1.0f, DOWNMIX_C, 0.0f, 0.0f, DOWNMIX_C };
+};
+
+// FL FR FC LFE BL BR SL SR
+template <> struct downmix_matrix<8> {
+    static constexpr float left[8] = { 1.0f, 0.0f, DOWNMIX_C, 0.0f, DOWNMIX_C, 0.0f, DOWNMIX_C, 0.0f };
+    static constexpr float right[8] = { 0.0f, 1.0f, DOWNMIX_C, 0.0f, 0.0f, DOWNMIX_C, 0.0f, DOWNMIX_C };
+};
+
+static inline float load_sample(const uint8_t* src) { return ((int)*src - 0x80) * SCALE_U8; }
+static inline float load_sample(const int16_t* src) { return *src * SCALE_S16; }
+static inline float load_sample(const int32_t* src) { return *src * SCALE_S32; }
+static inline float load_sample(const float* src) { return *src; }
+
+// Adds channel C of a frame to left and right. Zero weights are skipped at
+// compile time, so that a frame is just the multiply-adds that matter.
+template <typename T, uint32_t CHANNELS, uint32_t C>
+static inline void downmix_channel(const T* in, float& left, float& right)
+{
+    using matrix = downmix_matrix<CHANNELS>;
+
+    if constexpr (matrix::left[C] != 0.0f || matrix::right[C] != 0.0f) {
+        float sample = load_sample(in + C);
+        if constexpr (matrix::left[C] != 0.0f)
+            left += sample * matrix::left[C];
+        if constexpr (matrix::right[C] != 0.0f)
+            right += sample * matrix::right[C];
+    }
+}
+
+template <typename T, uint32_t CHANNELS, uint32_t... C>
+static void downmix(float* dst, const T* src, size_t frames_count,
+    std::integer_sequence<uint32_t, C...>)
+{
+    for (size_t frame = 0; frame < frames_count; frame++) {
+        const T* in = src + frame * CHANNELS;
+        float left = 0.0f;
+        float right = 0.0f;
+
+        (downmix_channel<T, CHANNELS, C>(in, left, right), ...);
+
+        dst[frame * 2] += left;
+        dst[frame * 2 + 1] += right;
+    }
+}
+
+template <typename T, uint32_t CHANNELS>
+static void downmix(float* dst, const T* src, size_t frames_count)
+{
+    downmix<T, CHANNELS>(dst, src, frames_count,
+        std::make_integer_sequence<uint32_t, CHANNELS>());
+}
+
+template <uint32_t CHANNELS>
+static void downmix(float* dst, const void* src, sample_format format,
+    size_t frames_count)
+{
+    switch (format) {
+    case sample_format::u8:
+        downmix<uint8_t, CHANNELS>(dst, (const uint8_t*)src, frames_count);
+        break;
+    case sample_format::s16:
+        downmix<int16_t, CHANNELS>(dst, (const int16_t*)src, frames_count);
+        break;
+    case sample_format::s32:
+        downmix<int32_t, CHANNELS>(dst, (const int32_t*)src, frames_count);
+        break;
+    case sample_format::f32:
+        downmix<float, CHANNELS>(dst, (const float*)src, frames_count);
+        break;
+    }
+}
+
+bool downmix_supported(uint32_t channels)
+{
+    return channels == 6 || channels == 8;
+}
+
+void downmix_samples(float* dst, const void* src, sample_format format,
+    uint32_t channels, size_t frames_count)
+{
+    if (channels == 6)
+        downmix<6>(dst, src, format, frames_count);
+    else if (channels == 8)
+        downmix<8>(dst, src, format, frames_count);
+}
+
+//--------------------------------------------------------------------[ dispatch
+
+// there is no AVX2 interleave2, shuffling floats two at a time gains nothing
+// over SSE2
+static kernel_table select_kernels()
+{
+#if defined(KERNELS_X86)
+    if (cpu_has_avx2())
+        return { "avx2", mix_samples_avx2, convert_u8_avx2, convert_s16_avx2,
+            convert_s32_avx2, interleave2_sse2 };
+    if (cpu_has_sse2())
+        return { "sse2", mix_samples_sse2, convert_u8_sse2, convert_s16_sse2,
+            convert_s32_sse2, interleave2_sse2 };
+#elif defined(KERNELS_NEON)
+    return { "neon", mix_samples_neon, convert_u8_neon, convert_s16_neon,
+        convert_s32_neon, interleave2_neon };
+#endif
+    return { "scalar", mix_samples_scalar, convert_u8_scalar,
+        convert_s16_scalar, convert_s32_scalar, interleave2_scalar };
+}
+
+static const kernel_table& get_kernels()
+{
+    static const kernel_table kernels = select_kernels();
+    return kernels;
+}
+
+void mix_samples(float* dst, const float* src, size_t count)
+{
+    get_kernels().mix(dst, src, count);
+}
+
+// Interleaved input converts sample for sample. Planar input converts a chunk
+// of each channel onto the stack, and then gets interleaved from there.
+static void convert_contiguous(const kernel_table& kernels, float* dst,
+    const uint8_t* src, sample_format format, size_t count)
+{
+    switch (format) {
+    case sample_format::u8:
+        kernels.convert_u8(dst, src, count);
+        break;
+    case sample_format::s16:
+        kernels.convert_s16(dst, (const int16_t*)src, count);
+        break;
+    case sample_format::s32:
+        kernels.convert_s32(dst, (const int32_t*)src, count);
+        break;
+    case sample_format::f32:
+        memcpy(dst, src, count * sizeof(float));
+        break;
+    }
+}
+
+void convert_samples(float* dst, const void* src, sample_format format,
+    bool planar, uint32_t channels, size_t frames_count)
+{
+    const kernel_table& kernels = get_kernels();
+    const uint8_t* bytes = (const uint8_t*)src;
+    size_t sample_size = sample_format_size(format);
+
+    if (!planar || channels == 1) {
+        convert_contiguous(kernels, dst, bytes, format, frames_count * channels);
+        return;
+    }
+
+    float chunk[2][PLANAR_CHUNK];
+    for (size_t frame = 0; frame < frames_count; frame += PLANAR_CHUNK) {
+        size_t count = frames_count - frame < PLANAR_CHUNK
+            ? frames_count - frame
+            : PLANAR_CHUNK;
+        float* out = dst + frame * channels;
+
+        if (channels == 2) {
+            for (uint32_t c = 0; c < 2; c++) {
+                const uint8_t* plane = bytes + (c * frames_count + frame) * sample_size;
+                convert_contiguous(kernels, chunk[c], plane, format, count);
+            }
+            kernels.interleave2(out, chunk[0], chunk[1], count);
+            continue;
+        }
+
+        for (uint32_t c = 0; c < channels; c++) {
+            const uint8_t* plane = bytes + (c * frames_count + frame) * sample_size;
+            convert_contiguous(kernels, chunk[0], plane, format, count);
+            for (size_t i = 0; i < count; i++)
+                out[i * channels + c] = chunk[0][i];
+        }
+    }
+}
+
+const char* mix_samples_kernel_name()
+{
+    return get_kernels().name;
+}
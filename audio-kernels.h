@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+enum class sample_format {
+    u8,
+    s16,
+    s32,
+    f32,
+};
+
+inline size_t sample_format_size(sample_format format)
+{
+    switch (format) {
+    case sample_format::u8:
+        return 1;
+    case sample_format::s16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Adds count samples from src onto dst. The widest kernel the CPU supports
+// (AVX2, SSE2, NEON, or plain scalar) is picked the first time it's called.
+void mix_samples(float* dst, const float* src, size_t count);
+
+// Converts frames_count frames of channels-channel input into interleaved
+// float, scaled exactly the way libswresample does it. Planar input holds its
+// channels one after the other. Dispatches along with mix_samples.
+void convert_samples(float* dst, const void* src, sample_format format,
+    bool planar, uint32_t channels, size_t frames_count);
+
+// Whether downmix_samples() has a kernel for this many input channels, which
+// is 5.1 and 7.1 in WASAPI's channel order.
+bool downmix_supported(uint32_t channels);
+
+// Converts frames_count frames of interleaved surround input, downmixes them
+// to stereo and adds them onto dst, all in a single pass. Uses the matrix swr
+// builds by default, so levels don't jump when a stream switches over.
+void downmix_samples(float* dst, const void* src, sample_format format,
+    uint32_t channels, size_t frames_count);
+
+// Name of the kernel mix_samples ended up dispatching to, for logging.
+const char* mix_samples_kernel_name();
@@ -0,0 +1,449 @@
+#include "audio-transport.h"
+#include "shm-transport.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include "win-pipe/win-pipe.h"
+#else
+#include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//-------------------------------------------------------------------------[ log
+
+static transport_log_t g_log = nullptr;
+
+void set_transport_log(transport_log_t log)
+{
+    g_log = log;
+}
+
+static void log_error(const char* format, ...)
+{
+    if (!g_log)
+        return;
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    g_log(message);
+}
+
+//------------------------------------------------------------------------[ pipe
+
+#ifdef _WIN32
+
+#define PIPE_PATH_PREFIX "\\\\.\\pipe\\"
+
+// how long a pipe that failed to wait for the hook waits to try again
+#define PIPE_RETRY_MS 1000
+
+class pipe_sender : public audio_sender {
+public:
+    pipe_sender(uint32_t pid)
+        : m_sender { AUDIO_PIPE_NAME + std::to_string(pid) }
+    {
+    }
+
+    // pipes want the whole message in one piece
+    bool send(const uint8_t* header, size_t header_size,
+        const uint8_t* data, size_t data_size) override
+    {
+        m_buffer.resize(header_size + data_size);
+        memcpy(m_buffer.data(), header, header_size);
+        if (data_size)
+            memcpy(m_buffer.data() + header_size, data, data_size);
+
+        m_sender.send(m_buffer.data(), m_buffer.size());
+        return true;
+    }
+
+private:
+    win_pipe::sender m_sender;
+    std::vector<uint8_t> m_buffer;
+};
+
+// Creates the pipe the same way win_pipe::receiver does, so win_pipe::sender
+// can't tell the difference, but reads it with overlapped I/O on the shared
+// io_loop instead of on a thread of its own. Only ever one operation is in
+// flight, either waiting for the hook to connect or reading a message.
+class pipe_receiver : public audio_receiver {
+public:
+    pipe_receiver(uint32_t pid, callback_t callback, io_loop& loop)
+        : m_callback(std::move(callback))
+        , m_loop(loop)
+        , m_pid(pid)
+        , m_buffer(BUFFER_SIZE)
+    {
+        m_retry_timer = CreateThreadpoolTimer(retry_due, this, NULL);
+        if (!m_retry_timer)
+            return;
+
+        std::string name = PIPE_PATH_PREFIX AUDIO_PIPE_NAME + std::to_string(pid);
+        m_pipe = CreateNamedPipeA(name.c_str(),
+            PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
+            PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT, 1, 0,
+            BUFFER_SIZE, 0, NULL);
+        if (m_pipe == INVALID_HANDLE_VALUE)
+            return;
+
+        m_id = m_loop.add(m_pipe,
+            [this](void* overlapped, size_t bytes, uint32_t error) {
+                complete(overlapped, bytes, error);
+            });
+        if (m_id)
+            connect();
+    }
+
+    ~pipe_receiver() override
+    {
+        // a retry that's already been posted gets dropped along with m_id
+        if (m_retry_timer) {
+            SetThreadpoolTimer(m_retry_timer, NULL, 0, 0);
+            WaitForThreadpoolTimerCallbacks(m_retry_timer, TRUE);
+            CloseThreadpoolTimer(m_retry_timer);
+        }
+        if (m_id)
+            m_loop.remove(m_id);
+        if (m_pipe == INVALID_HANDLE_VALUE)
+            return;
+
+        // the kernel still owns m_overlapped and m_buffer until whatever was
+        // in flight has been cancelled
+        DWORD bytes;
+        CancelIoEx(m_pipe, &m_overlapped);
+        GetOverlappedResult(m_pipe, &m_overlapped, &bytes, TRUE);
+        CloseHandle(m_pipe);
+    }
+
+public:
+    static constexpr DWORD BUFFER_SIZE = 1 << 16;
+
+private:
+    void connect()
+    {
+        m_overlapped = {};
+        m_connecting = true;
+        if (ConnectNamedPipe(m_pipe, &m_overlapped))
+            return;
+
+        DWORD error = GetLastError();
+        switch (error) {
+        case ERROR_IO_PENDING:
+            break;
+
+        // connected before we got to wait for it, so nothing gets queued
+        case ERROR_PIPE_CONNECTED:
+            read(0);
+            break;
+
+        // and already went away again, which has to be cleared up first
+        case ERROR_NO_DATA:
+            reconnect();
+            break;
+
+        default:
+            log_error("pipe for %u failed to wait for the hook (error %lu), "
+                      "retrying",
+                m_pid, error);
+            retry_later();
+        }
+    }
+
+    void reconnect()
+    {
+        DisconnectNamedPipe(m_pipe);
+        connect();
+    }
+
+    // Has the io_loop's thread try connecting again in a while, rather than
+    // right away and over and over.
+    void retry_later()
+    {
+        m_connecting = false;
+
+        int64_t due = -(int64_t)PIPE_RETRY_MS * 10'000;
+        FILETIME time = { (DWORD)due, (DWORD)(due >> 32) };
+        SetThreadpoolTimer(m_retry_timer, &time, 0, 0);
+    }
+
+    static void CALLBACK retry_due(PTP_CALLBACK_INSTANCE, void* context,
+        PTP_TIMER)
+    {
+        auto* receiver = (pipe_receiver*)context;
+        receiver->m_loop.post(receiver->m_id, &receiver->m_retry);
+    }
+
+    // offset is how much of a message that didn't fit was already read.
+    // Completions get queued even if ReadFile finishes right away, only an
+    // outright failure doesn't.
+    void read(size_t offset)
+    {
+        m_overlapped = {};
+        m_connecting = false;
+        m_offset = offset;
+
+        if (ReadFile(m_pipe, m_buffer.data() + offset,
+                (DWORD)(m_buffer.size() - offset), NULL, &m_overlapped))
+            return;
+
+        DWORD error = GetLastError();
+        if (error != ERROR_IO_PENDING && error != ERROR_MORE_DATA)
+            reconnect();
+    }
+
+    // Runs on the io_loop's thread.
+    void complete(void* overlapped, size_t bytes, uint32_t error)
+    {
+        if (overlapped == &m_retry) {
+            reconnect();
+            return;
+        }
+
+        if (m_connecting) {
+            if (error && error != ERROR_PIPE_CONNECTED)
+                reconnect();
+            else
+                read(0);
+            return;
+        }
+
+        size_t size = m_offset + bytes;
+        if (error == ERROR_MORE_DATA) {
+            m_buffer.resize(m_buffer.size() * 2);
+            read(size);
+            return;
+        }
+
+        // the hook went away, so wait for the next one
+        if (error) {
+            reconnect();
+            return;
+        }
+
+        m_callback(m_buffer.data(), size);
+        read(0);
+    }
+
+private:
+    callback_t m_callback;
+    io_loop& m_loop;
+    uint64_t m_id = 0;
+    uint32_t m_pid;
+
+    HANDLE m_pipe = INVALID_HANDLE_VALUE;
+    OVERLAPPED m_overlapped = {};
+    bool m_connecting = false;
+
+    // never handed to the kernel, only tells a posted retry apart
+    OVERLAPPED m_retry = {};
+    PTP_TIMER m_retry_timer = NULL;
+
+    // grows to fit the largest message so far
+    std::vector<uint8_t> m_buffer;
+    size_t m_offset = 0;
+};
+
+#else
+
+// Stand-in for message pipes, which is only there to run this without
+// Windows: a datagram socket in the abstract namespace, which keeps every
+// message in one piece just the same.
+static sockaddr_un pipe_address(uint32_t pid, socklen_t& length)
+{
+    std::string name = AUDIO_PIPE_NAME + std::to_string(pid);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path + 1, name.data(), name.size());
+    length = (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+    return address;
+}
+
+class pipe_sender : public audio_sender {
+public:
+    pipe_sender(uint32_t pid)
+        : m_socket(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+        , m_address(pipe_address(pid, m_address_size))
+    {
+    }
+
+    ~pipe_sender() override
+    {
+        if (m_socket >= 0)
+            close(m_socket);
+    }
+
+    // fails if nobody is listening or their queue is full
+    bool send(const uint8_t* header, size_t header_size,
+        const uint8_t* data, size_t data_size) override
+    {
+        iovec parts[2] = {
+            { (void*)header, header_size },
+            { (void*)data, data_size },
+        };
+
+        msghdr message = {};
+        message.msg_name = &m_address;
+        message.msg_namelen = m_address_size;
+        message.msg_iov = parts;
+        message.msg_iovlen = data_size ? 2 : 1;
+
+        return sendmsg(m_socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0;
+    }
+
+private:
+    int m_socket;
+    socklen_t m_address_size = 0;
+    sockaddr_un m_address;
+};
+
+class pipe_receiver : public audio_receiver {
+public:
+    pipe_receiver(uint32_t pid, callback_t callback, io_loop& loop)
+        : m_callback(std::move(callback))
+        , m_loop(loop)
+        , m_buffer(BUFFER_SIZE)
+    {
+        m_socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_socket < 0)
+            return;
+
+        socklen_t address_size;
+        sockaddr_un address = pipe_address(pid, address_size);
+        if (bind(m_socket, (sockaddr*)&address, address_size) != 0) {
+            log_error("pipe for %u failed to bind (errno %d)", pid, errno);
+            return;
+        }
+
+        m_id = m_loop.add(m_socket, [this](void*, size_t, uint32_t) {
+            drain();
+        });
+    }
+
+    ~pipe_receiver() override
+    {
+        if (m_id)
+            m_loop.remove(m_id);
+        if (m_socket >= 0)
+            close(m_socket);
+    }
+
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+private:
+    // Runs on the io_loop's thread.
+    void drain()
+    {
+        while (true) {
+            ssize_t size = recv(m_socket, m_buffer.data(), m_buffer.size(),
+                MSG_TRUNC);
+            if (size < 0)
+                return;
+
+            // that one is lost, but the next one that big will fit
+            if ((size_t)size > m_buffer.size()) {
+                m_buffer.resize((size_t)size);
+                continue;
+            }
+
+            m_callback(m_buffer.data(), (size_t)size);
+        }
+    }
+
+private:
+    callback_t m_callback;
+    io_loop& m_loop;
+    uint64_t m_id = 0;
+    int m_socket = -1;
+
+    // grows to fit the largest message so far
+    std::vector<uint8_t> m_buffer;
+};
+
+#endif
+
+//-------------------------------------------------------------------[ automatic
+
+// Tries each sender in order until one of them takes the message.
+class fallback_sender : public audio_sender {
+public:
+    void add(std::unique_ptr<audio_sender> sender)
+    {
+        if (sender)
+            m_senders.push_back(std::move(sender));
+    }
+
+    bool send(const uint8_t* header, size_t header_size,
+        const uint8_t* data, size_t data_size) override
+    {
+        for (auto& sender : m_senders) {
+            if (sender->send(header, header_size, data, data_size))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    std::vector<std::unique_ptr<audio_sender>> m_senders;
+};
+
+//-------------------------------------------------------------------[ factories
+
+std::unique_ptr<audio_sender> create_audio_sender(audio_transport transport,
+    uint32_t pid)
+{
+    switch (transport) {
+    case audio_transport::pipe:
+        return std::make_unique<pipe_sender>(pid);
+    case audio_transport::shm:
+        return std::make_unique<shm_sender>(pid);
+    case audio_transport::automatic: {
+        auto sender = std::make_unique<fallback_sender>();
+        sender->add(create_audio_sender(audio_transport::shm, pid));
+        sender->add(create_audio_sender(audio_transport::pipe, pid));
+        return sender;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+std::unique_ptr<audio_receiver> create_audio_receiver(audio_transport transport,
+    uint32_t pid, audio_receiver::callback_t callback, io_loop& loop)
+{
+    switch (transport) {
+    case audio_transport::pipe:
+        return std::make_unique<pipe_receiver>(pid, std::move(callback), loop);
+    case audio_transport::shm: {
+        auto receiver = std::make_unique<shm_receiver>(pid, std::move(callback),
+            loop);
+        if (!receiver->valid())
+            return nullptr;
+        return receiver;
+    }
+    case audio_transport::automatic: {
+        auto receiver = create_audio_receiver(audio_transport::shm, pid,
+            callback, loop);
+        if (!receiver)
+            receiver = create_audio_receiver(audio_transport::pipe, pid,
+                callback, loop);
+        return receiver;
+    }
+    default:
+        return nullptr;
+    }
+}
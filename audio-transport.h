@@ -0,0 +1,61 @@
+#pragma once
+#include "io-loop.h"
+
+#include <functional>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+// clang-format off
+
+#define AUDIO_PIPE_NAME                 "AudioHook_Pipe"
+#define AUDIO_SHM_NAME                  "AudioHook_Shm"
+#define AUDIO_SHM_EVENT_NAME            "AudioHook_Event"
+#define AUDIO_SHM_SIZE                  (1 << 20)
+
+// clang-format on
+
+// How packets get from audio-hook to the plugin. The hook tries shared memory
+// first and falls back to the pipe, so the plugin alone picks which one is
+// used by which receiver it opens.
+enum class audio_transport {
+    pipe,
+    shm,
+    automatic,
+
+    // no receiver at all, packets only get there through
+    // audio_pipe_manager::feed()
+    none,
+};
+
+class audio_sender {
+public:
+    virtual ~audio_sender() = default;
+
+    // Sends header and data as one message. Returns false if nobody is
+    // listening or there's no room, in which case the message is dropped.
+    virtual bool send(const uint8_t* header, size_t header_size,
+        const uint8_t* data, size_t data_size)
+        = 0;
+};
+
+// Calls back with every message sent to it until it's destroyed, on the
+// io_loop's thread, which every pipe and shared memory region shares.
+class audio_receiver {
+public:
+    using callback_t = std::function<void(uint8_t*, size_t)>;
+
+    virtual ~audio_receiver() = default;
+};
+
+// Where receivers report what went wrong with their end of the transport. The
+// plugin points it at its log, the hook leaves it unset, since libobs isn't
+// loaded there.
+using transport_log_t = void (*)(const char* message);
+void set_transport_log(transport_log_t log);
+
+std::unique_ptr<audio_sender> create_audio_sender(audio_transport transport,
+    uint32_t pid);
+
+std::unique_ptr<audio_receiver> create_audio_receiver(audio_transport transport,
+    uint32_t pid, audio_receiver::callback_t callback, io_loop& loop);
@@ -0,0 +1,213 @@
+#include "application-manager.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+static int g_failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        g_failures++;
+    }
+}
+
+// Sessions and executables made up by the test, owned by it so it can keep
+// changing them underneath the manager.
+struct fake_processes {
+    struct process {
+        std::string session_name;
+        bool x64 = true;
+        uint64_t start_time = 0;
+    };
+
+    std::unordered_map<uint32_t, process> running;
+    std::unordered_set<uint32_t> undescribable;
+    std::vector<uint32_t> described;
+};
+
+class fake_session_backend : public session_backend {
+public:
+    fake_session_backend(fake_processes& processes)
+        : m_processes(processes)
+    {
+    }
+
+    bool enumerate(std::vector<audio_session>& sessions) override
+    {
+        for (auto& [pid, proc] : m_processes.running)
+            sessions.push_back({ pid, L"", proc.start_time });
+        return true;
+    }
+
+    bool describe(uint32_t pid, std::string& session_name, bool& x64) override
+    {
+        m_processes.described.push_back(pid);
+
+        auto it = m_processes.running.find(pid);
+        if (it == m_processes.running.end()
+            || m_processes.undescribable.count(pid))
+            return false;
+
+        session_name = it->second.session_name;
+        x64 = it->second.x64;
+        return true;
+    }
+
+private:
+    fake_processes& m_processes;
+};
+
+static bool has(const std::vector<application_manager::process>& procs,
+    uint32_t pid, const char* session_name)
+{
+    return std::any_of(procs.begin(), procs.end(), [&](const auto& proc) {
+        return proc.pid == pid && proc.session_name == session_name;
+    });
+}
+
+static bool runs(const application_manager& manager, const char* session_name,
+    uint32_t pid)
+{
+    auto& apps = manager.applications();
+    auto it = apps.find(session_name);
+    return it != apps.end() && it->second.contains(pid);
+}
+
+static void test_delta()
+{
+    fake_processes processes;
+    application_manager manager(std::make_unique<fake_session_backend>(processes));
+    application_manager::delta changes;
+
+    processes.running[10] = { "game.exe" };
+    processes.running[11] = { "game.exe" };
+    processes.running[20] = { "chat.exe", false };
+    check(manager.refresh(changes), "refresh works");
+    manager.apply(changes);
+    check(changes.added.size() == 3 && changes.removed.empty(),
+        "every new pid is added");
+    check(runs(manager, "game.exe", 10) && runs(manager, "game.exe", 11)
+            && runs(manager, "chat.exe", 20),
+        "applications have every added pid");
+    check(!manager.applications().at("chat.exe").processes().at(20),
+        "bitness comes from describe");
+
+    processes.described.clear();
+    manager.refresh(changes);
+    manager.apply(changes);
+    check(changes.empty(), "nothing changed, nothing in the delta");
+    check(processes.described.empty(), "known pids aren't described again");
+
+    processes.running.erase(11);
+    processes.running[30] = { "music.exe" };
+    manager.refresh(changes);
+    manager.apply(changes);
+    check(changes.added.size() == 1 && has(changes.added, 30, "music.exe"),
+        "only the new pid is added");
+    check(changes.removed.size() == 1 && has(changes.removed, 11, "game.exe"),
+        "only the vanished pid is removed");
+    check(!runs(manager, "game.exe", 11) && runs(manager, "game.exe", 10),
+        "the application keeps its other pid");
+
+    processes.running.erase(20);
+    manager.refresh(changes);
+    manager.apply(changes);
+    check(!manager.contains("chat.exe"),
+        "an application goes away with its last pid");
+}
+
+// describe() fails for a while, which is retried after 1, 2, 4... refreshes
+// up to MAX_DESCRIBE_BACKOFF, and added as soon as it works.
+static void test_backoff()
+{
+    fake_processes processes;
+    application_manager manager(std::make_unique<fake_session_backend>(processes));
+    application_manager::delta changes;
+
+    processes.running[40] = { "slow.exe" };
+    processes.undescribable.insert(40);
+
+    std::vector<int> attempts;
+    for (int refresh = 1; refresh <= 100; refresh++) {
+        processes.described.clear();
+        manager.refresh(changes);
+        manager.apply(changes);
+        if (!processes.described.empty())
+            attempts.push_back(refresh);
+        check(changes.empty(), "an undescribable pid is never added");
+    }
+
+    std::vector<int> expected = { 1, 2, 4, 8, 16, 32, 64, 96 };
+    check(attempts == expected, "describe backs off up to 32 refreshes");
+
+    processes.undescribable.clear();
+    int added_at = 0;
+    for (int refresh = 101; refresh <= 140 && !added_at; refresh++) {
+        manager.refresh(changes);
+        manager.apply(changes);
+        if (has(changes.added, 40, "slow.exe"))
+            added_at = refresh;
+    }
+    check(added_at == 128, "the pid is added on the next retry that works");
+
+    // gone and back counts as new, backoff and all
+    processes.running.erase(40);
+    manager.refresh(changes);
+    processes.running[40] = { "slow.exe" };
+    processes.described.clear();
+    manager.refresh(changes);
+    check(processes.described.size() == 1 && has(changes.added, 40, "slow.exe"),
+        "a pid that comes back is described again right away");
+}
+
+static void test_pid_reuse()
+{
+    fake_processes processes;
+    application_manager manager(std::make_unique<fake_session_backend>(processes));
+    application_manager::delta changes;
+
+    processes.running[50] = { "old.exe", true, 1000 };
+    manager.refresh(changes);
+    manager.apply(changes);
+
+    // exited and got its pid handed to something else in between refreshes
+    processes.running[50] = { "new.exe", false, 2000 };
+    manager.refresh(changes);
+    manager.apply(changes);
+    check(has(changes.removed, 50, "old.exe"), "the old process is removed");
+    check(has(changes.added, 50, "new.exe"), "the new process is added");
+    check(!manager.contains("old.exe") && runs(manager, "new.exe", 50),
+        "the pid moves over to the new application");
+
+    // no start time at all can't tell either way, so nothing changes
+    processes.running[50].start_time = 0;
+    processes.described.clear();
+    manager.refresh(changes);
+    check(changes.empty() && processes.described.empty(),
+        "an unknown start time isn't taken for a new process");
+
+    // a reused pid that can't be described yet still loses the old process
+    processes.running[50] = { "newer.exe", true, 3000 };
+    processes.undescribable.insert(50);
+    manager.refresh(changes);
+    manager.apply(changes);
+    check(has(changes.removed, 50, "new.exe") && changes.added.empty(),
+        "a reused pid drops the old process before it's described");
+    check(!manager.contains("new.exe"), "nothing is left of the old process");
+}
+
+int main()
+{
+    test_delta();
+    test_backoff();
+    test_pid_reuse();
+
+    if (g_failures)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
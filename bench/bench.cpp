@@ -0,0 +1,286 @@
+#include "audio-helpers.h"
+#include "audio-hook-info.h"
+#include "audio-kernels.h"
+#include "obs-stubs.h"
+#include "replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// clang-format off
+
+// what WASAPI usually sends, and what OBS usually outputs
+#define PACKET_DURATION                 10'000'000
+#define OUTPUT_RATE                     48000
+#define OUTPUT_SPEAKERS                 SPEAKERS_STEREO
+
+#define KERNEL_FRAMES                   4800
+#define KERNEL_ITERATIONS               2000
+
+// simulated seconds of audio per run, unless given on the command line
+#define DEFAULT_SECONDS                 10
+
+// clang-format on
+
+static uint64_t now_ns()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Average nanoseconds per call of func.
+template <typename F>
+static double time_calls(int iterations, F&& func)
+{
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; i++)
+        func();
+    return (double)(now_ns() - start) / iterations;
+}
+
+//---------------------------------------------------------------------[ kernels
+
+static const char* format_name(sample_format format)
+{
+    switch (format) {
+    case sample_format::u8:
+        return "u8";
+    case sample_format::s16:
+        return "s16";
+    case sample_format::s32:
+        return "s32";
+    default:
+        return "f32";
+    }
+}
+
+static void bench_kernels()
+{
+    static constexpr sample_format FORMATS[] = {
+        sample_format::u8,
+        sample_format::s16,
+        sample_format::s32,
+        sample_format::f32,
+    };
+
+    std::vector<float> dst(KERNEL_FRAMES * 8);
+    std::vector<float> src(KERNEL_FRAMES * 8, 0.25f);
+
+    // 0x3E bytes read as a small float, and as middling integers
+    std::vector<uint8_t> raw(KERNEL_FRAMES * 8 * sizeof(float), 0x3E);
+
+    printf("kernels (%s), ns per output sample\n", mix_samples_kernel_name());
+
+    double ns = time_calls(KERNEL_ITERATIONS, [&] {
+        mix_samples(dst.data(), src.data(), KERNEL_FRAMES * 2);
+    });
+    printf("  %-28s %8.3f\n", "mix", ns / (KERNEL_FRAMES * 2));
+
+    for (sample_format format : FORMATS) {
+        for (bool planar : { false, true }) {
+            ns = time_calls(KERNEL_ITERATIONS, [&] {
+                convert_samples(dst.data(), raw.data(), format, planar, 2,
+                    KERNEL_FRAMES);
+            });
+
+            char name[64];
+            snprintf(name, sizeof(name), "convert %s%s stereo",
+                format_name(format), planar ? " planar" : "");
+            printf("  %-28s %8.3f\n", name, ns / (KERNEL_FRAMES * 2));
+        }
+    }
+
+    for (uint32_t channels : { 6u, 8u }) {
+        for (sample_format format : FORMATS) {
+            ns = time_calls(KERNEL_ITERATIONS, [&] {
+                downmix_samples(dst.data(), raw.data(), format, channels,
+                    KERNEL_FRAMES);
+            });
+
+            char name[64];
+            snprintf(name, sizeof(name), "downmix %s %u.1", format_name(format),
+                channels - 1);
+            printf("  %-28s %8.3f\n", name, ns / (KERNEL_FRAMES * 2));
+        }
+    }
+
+    printf("\n");
+}
+
+//-------------------------------------------------------------------[ read path
+
+struct stream_format {
+    const char* name;
+    speaker_layout layout;
+    audio_format format;
+    int sample_rate;
+};
+
+struct buffer_preset {
+    const char* name;
+    uint64_t duration;
+};
+
+struct run_result {
+    double packets_per_second;
+    double ns_per_frame;
+    double pop_average_us;
+    double pop_max_us;
+};
+
+// Each of them takes a different path through audio_pipe::read.
+static const stream_format STREAM_FORMATS[] = {
+    { "f32 stereo 48k", SPEAKERS_STEREO, AUDIO_FORMAT_FLOAT, 48000 },
+    { "s16 stereo 48k", SPEAKERS_STEREO, AUDIO_FORMAT_16BIT, 48000 },
+    { "f32 planar stereo 48k", SPEAKERS_STEREO, AUDIO_FORMAT_FLOAT_PLANAR, 48000 },
+    { "f32 5.1 48k", SPEAKERS_5POINT1, AUDIO_FORMAT_FLOAT, 48000 },
+    { "f32 stereo 44.1k", SPEAKERS_STEREO, AUDIO_FORMAT_FLOAT, 44100 },
+};
+
+// same as app-audio-capture's BUFFER_* presets
+static const buffer_preset BUFFER_PRESETS[] = {
+    { "smallest", 240'000'000 },
+    { "normal", 480'000'000 },
+    { "biggest", 600'000'000 },
+};
+
+static const uint32_t STREAM_COUNTS[] = { 1, 4, 16, 64 };
+
+// A quiet sine, not that any of the kernels care what's in it.
+static std::vector<uint8_t> make_packet(const stream_format& format)
+{
+    uint32_t frames = (uint32_t)(format.sample_rate / 100);
+    uint32_t channels = get_audio_channels(format.layout);
+    bool planar = is_audio_planar(format.format);
+
+    std::vector<uint8_t> packet(sizeof(audio_metadata)
+        + (size_t)frames * channels * get_audio_bytes_per_channel(format.format));
+
+    audio_metadata md = {
+        .magic = AUDIO_PROTOCOL_MAGIC,
+        .version = AUDIO_PROTOCOL_VERSION,
+        .timestamp = 0,
+        .layout = format.layout,
+        .format = format.format,
+        .samples_per_sec = format.sample_rate,
+        .frames = frames,
+        .flags = 0,
+    };
+    memcpy(packet.data(), &md, sizeof(md));
+
+    uint8_t* data = packet.data() + sizeof(md);
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        double value = 0.1 * sin(frame * 6.283185307179586 * 440 / format.sample_rate);
+        for (uint32_t channel = 0; channel < channels; channel++) {
+            size_t index = planar ? channel * frames + frame : frame * channels + channel;
+            if (format.format == AUDIO_FORMAT_16BIT)
+                ((int16_t*)data)[index] = (int16_t)(value * INT16_MAX);
+            else
+                ((float*)data)[index] = (float)value;
+        }
+    }
+
+    return packet;
+}
+
+// Feeds streams packets every PACKET_DURATION of fake time through their own
+// pipes into one mixer, popping whenever the mixer is ready to.
+static run_result run(const stream_format& format, uint64_t buffer,
+    uint32_t streams, int seconds)
+{
+    uint64_t time = 1'000'000'000;
+    set_bench_time(time);
+
+    audio_mixer mixer;
+    mixer.set_format(OUTPUT_RATE, OUTPUT_SPEAKERS);
+    mixer.resize(mixer.calculate_size(buffer));
+
+    audio_pipe_manager pipes;
+    pipes.set_transport(audio_transport::none);
+    for (uint32_t pid = 1; pid <= streams; pid++) {
+        pipes.add(pid);
+        pipes.set_mixers(pid, { &mixer });
+    }
+
+    std::vector<uint8_t> packet = make_packet(format);
+    auto* md = (audio_metadata*)packet.data();
+
+    uint64_t read_ns = 0;
+    uint64_t pop_ns = 0;
+    uint64_t pop_max_ns = 0;
+    uint64_t pops = 0;
+    uint64_t packets = 0;
+
+    for (int tick = 0; tick < seconds * 100; tick++) {
+        time += PACKET_DURATION;
+        set_bench_time(time);
+        md->timestamp = time;
+
+        uint64_t start = now_ns();
+        for (uint32_t pid = 1; pid <= streams; pid++)
+            pipes.feed(pid, packet.data(), packet.size());
+        read_ns += now_ns() - start;
+        packets += streams;
+
+        while (mixer.ready_to_pop()) {
+            start = now_ns();
+            audio_mixer::block_view view = mixer.pop();
+            mixer.release(view);
+
+            uint64_t elapsed = now_ns() - start;
+            pop_ns += elapsed;
+            pop_max_ns = std::max(pop_max_ns, elapsed);
+            pops++;
+        }
+    }
+
+    // every stream's frames end up at the mixer's rate
+    uint64_t mixed_frames = packets * OUTPUT_RATE / 100;
+
+    return {
+        .packets_per_second = read_ns ? packets * 1e9 / read_ns : 0,
+        .ns_per_frame = mixed_frames ? (double)pop_ns / mixed_frames : 0,
+        .pop_average_us = pops ? pop_ns / 1e3 / pops : 0,
+        .pop_max_us = pop_max_ns / 1e3,
+    };
+}
+
+static void bench_read_path(int seconds)
+{
+    printf("read path, 10ms packets into a %dHz stereo mixer, %ds each\n",
+        OUTPUT_RATE, seconds);
+    printf("  %-22s %-9s %7s %12s %9s %9s %9s\n", "format", "buffer",
+        "streams", "packets/s", "ns/frame", "pop avg", "pop max");
+
+    for (const stream_format& format : STREAM_FORMATS) {
+        for (const buffer_preset& buffer : BUFFER_PRESETS) {
+            for (uint32_t streams : STREAM_COUNTS) {
+                run_result result = run(format, buffer.duration, streams,
+                    seconds);
+                printf("  %-22s %-9s %7u %12.0f %9.2f %7.1fus %7.1fus\n",
+                    format.name, buffer.name, streams,
+                    result.packets_per_second, result.ns_per_frame,
+                    result.pop_average_us, result.pop_max_us);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "replay") == 0)
+        return replay_main(argc - 2, argv + 2);
+
+    int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+    if (seconds <= 0)
+        seconds = DEFAULT_SECONDS;
+
+    bench_kernels();
+    bench_read_path(seconds);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "audio-helpers.h"
+#include "audio-hook-info.h"
+#include "obs-stubs.h"
+#include "swr-stubs.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// clang-format off
+
+// a 44.1kHz stream keeps swr in the loop the whole time
+#define STREAM_RATE                     44100
+#define STREAM_FRAMES                   441
+#define OUTPUT_RATE                     48000
+
+// nanoseconds of the app's own clock per packet
+#define PACKET_DURATION                 10'000'000
+
+#define BUFFER_DURATION                 480'000'000
+#define SIMULATED_SECONDS               60
+
+// compensation is only averaged over the last stretch, once it has settled
+#define SETTLED_PACKETS                 2000
+
+// clang-format on
+
+static int g_failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        g_failures++;
+    }
+}
+
+// Spread evenly over +/-jitter, the same every run.
+static int64_t next_jitter(uint32_t& seed, int64_t jitter)
+{
+    seed = seed * 1664525 + 1013904223;
+    return jitter ? (int64_t)(seed >> 8) % (2 * jitter + 1) - jitter : 0;
+}
+
+static void test_estimator()
+{
+    drift_estimator drift;
+
+    drift.update(3'000'000);
+    check(drift.error() == 3'000'000, "the first error is taken as is");
+
+    drift.reset();
+    drift.update(0);
+    for (int i = 0; i < 1000; i++)
+        drift.update(1'000'000);
+    check(llabs(drift.error() - 1'000'000) < 1'000,
+        "a constant error is converged on");
+    check(abs(drift.compensation(OUTPUT_RATE) - 48) <= 1,
+        "1ms early means 48 more samples over the next second");
+
+    for (int i = 0; i < 1000; i++)
+        drift.update(-1'000'000'000);
+    int limit = (int)(OUTPUT_RATE * drift_estimator::MAX_RATIO);
+    check(drift.compensation(OUTPUT_RATE) == -limit,
+        "compensation is clamped to MAX_RATIO");
+}
+
+struct skew_result {
+    double average_compensation;
+    audio_pipe_stats stats;
+    swr_stub_stats swr;
+};
+
+// Streams SIMULATED_SECONDS of packets from an app whose device clock runs
+// ppm fast or slow against OBS's, through a pipe into a mixer that keeps
+// popping on OBS's clock.
+static skew_result run_skew(double ppm, int64_t jitter)
+{
+    uint64_t start = 1'000'000'000;
+    set_bench_time(start);
+    reset_swr_stub_stats();
+
+    audio_mixer mixer;
+    mixer.set_format(OUTPUT_RATE, SPEAKERS_STEREO);
+    mixer.resize(mixer.calculate_size(BUFFER_DURATION));
+
+    audio_pipe_manager pipes;
+    pipes.set_transport(audio_transport::none);
+    pipes.add(1);
+    pipes.set_mixers(1, { &mixer });
+
+    std::vector<uint8_t> packet(sizeof(audio_metadata)
+        + STREAM_FRAMES * 2 * sizeof(float));
+    audio_metadata md = {
+        .magic = AUDIO_PROTOCOL_MAGIC,
+        .version = AUDIO_PROTOCOL_VERSION,
+        .timestamp = 0,
+        .layout = SPEAKERS_STEREO,
+        .format = AUDIO_FORMAT_FLOAT,
+        .samples_per_sec = STREAM_RATE,
+        .frames = STREAM_FRAMES,
+        .flags = 0,
+    };
+
+    uint32_t seed = 1;
+    double compensation_sum = 0;
+    int packets = SIMULATED_SECONDS * 100;
+
+    for (int k = 0; k < packets; k++) {
+        // the app thinks every packet is PACKET_DURATION long, OBS's clock
+        // sees them come in slightly further apart or closer together
+        uint64_t released = start
+            + (uint64_t)llround((double)k * PACKET_DURATION * (1.0 + ppm * 1e-6));
+        md.timestamp = released + next_jitter(seed, jitter);
+
+        while (mixer.pop_deadline() < released) {
+            set_bench_time(mixer.pop_deadline() + 1);
+            mixer.release(mixer.pop());
+        }
+        set_bench_time(released);
+
+        memcpy(packet.data(), &md, sizeof(md));
+        pipes.feed(1, packet.data(), packet.size());
+
+        if (k >= packets - SETTLED_PACKETS)
+            compensation_sum += get_swr_stub_stats().last_compensation;
+    }
+
+    auto stats = pipes.stats(&mixer);
+    return {
+        .average_compensation = compensation_sum / SETTLED_PACKETS,
+        .stats = stats.empty() ? audio_pipe_stats {} : stats.front(),
+        .swr = get_swr_stub_stats(),
+    };
+}
+
+static void test_skew(double ppm, int64_t jitter)
+{
+    skew_result result = run_skew(ppm, jitter);
+    int limit = (int)(OUTPUT_RATE * drift_estimator::MAX_RATIO);
+
+    // stretching by ppm takes ppm of every second's samples
+    double expected = ppm * 1e-6 * OUTPUT_RATE;
+
+    printf("  %+7.0fppm +/-%lldms jitter: compensation %+7.2f (expected "
+           "%+7.2f), max %d, %llu unsnapped\n",
+        ppm, (long long)(jitter / 1'000'000), result.average_compensation,
+        expected, result.swr.max_compensation,
+        (unsigned long long)result.stats.discontiguous);
+
+    char what[128];
+    snprintf(what, sizeof(what), "%+.0fppm: compensation converges", ppm);
+    check(fabs(result.average_compensation - expected) < 2.0 + fabs(expected) * 0.1,
+        what);
+
+    snprintf(what, sizeof(what), "%+.0fppm: compensation stays bounded", ppm);
+    check(result.swr.max_compensation <= limit, what);
+
+    snprintf(what, sizeof(what), "%+.0fppm: compensation is per second", ppm);
+    check(result.swr.compensations == 0
+            || result.swr.last_compensation_distance == OUTPUT_RATE,
+        what);
+
+    // only the very first packet starts the timeline over
+    snprintf(what, sizeof(what), "%+.0fppm: stream stays snapped", ppm);
+    check(result.stats.discontiguous == 1, what);
+}
+
+// Drifting further than MAX_RATIO can make up for has to end in a snap, but
+// compensation must never go past the limit trying.
+static void test_runaway()
+{
+    skew_result result = run_skew(20'000, 0);
+    int limit = (int)(OUTPUT_RATE * drift_estimator::MAX_RATIO);
+
+    printf("  %+7.0fppm: max compensation %d, %llu unsnapped\n", 20'000.0,
+        result.swr.max_compensation,
+        (unsigned long long)result.stats.discontiguous);
+
+    check(result.swr.max_compensation == limit,
+        "runaway drift: compensation saturates at MAX_RATIO");
+    check(result.stats.discontiguous > 1,
+        "runaway drift: the stream snaps once it gets too far off");
+}
+
+int main()
+{
+    test_estimator();
+
+    printf("drift compensation, %dHz into %dHz over %ds\n", STREAM_RATE,
+        OUTPUT_RATE, SIMULATED_SECONDS);
+    test_skew(0, 0);
+    test_skew(300, 0);
+    test_skew(-300, 0);
+    test_skew(300, 2'000'000);
+    test_skew(-1'000, 2'000'000);
+    test_runaway();
+
+    if (g_failures)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
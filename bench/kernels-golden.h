@@ -0,0 +1,223 @@
+#pragma once
+#include <stdint.h>
+
+// What libswresample makes of every input value the kernel test feeds in,
+// as float bit patterns. FFmpeg's libraries aren't available to the tests,
+// so these weren't captured from swr itself, but worked out from the
+// conversions in its audioconvert.c:
+//
+//   u8   (x - 0x80) * (1.0f / (1 << 7))
+//   s16  x * (1.0f / (1 << 15))
+//   s32  x * (1.0f / (1U << 31)), x rounded to float first
+//   f32  as is
+//
+// and, for the downmixes, the default 5.1 and 7.1 to stereo matrix swr's
+// rematrix.c builds for float output, summed in float over the nonzero
+// weights in channel order. Frame f's channel c is input value
+// (f * channels + c) * 5, modulo the number of values.
+//
+// So the kernels are checked against that model of swr rather than against
+// swr's own output.
+
+// clang-format off
+
+static const int16_t GOLDEN_S16_IN[] = {
+    -32768, -32767, -16384, -257, -256, -255, -2, -1, 0, 1, 2, 255, 256, 257,
+    16383, 16384, 32766, 32767, -18148, -17286, -29630, 2322, 30641, 19017,
+    29339, -8041, 6660, 4148, -19484, -5695, -16568, 23520, -26256, 21974, -15,
+    9007, 30675, 26714, -7756, 26695, -15646, 31503, 2947, -8821, 25008, 16891,
+    14740, -13920, 17041, 20321, -3750, 11112, 12057, -10299, 30090, 7689,
+    -8163, -18964, -1513, 31974, 20912, -20776, 6197, -14428,
+};
+
+static const int32_t GOLDEN_S32_IN[] = {
+    INT32_MIN, -2147483647, -2147483521, -2147483520, -2147483519, -16777219,
+    -16777217, -1, 0, 1, 16777215, 16777216, 16777217, 16777218, 16777219,
+    1073741887, 1073741888, 1073741889, 2147483519, 2147483520, 2147483583,
+    2147483584, 2147483647, 1842816562, 1148571625, -184395724, 969287171,
+    -722529402, 913331501, 326644904, 1122799591, -245937126, -1262867279,
+    -184893860, 738149899, 90235886, 1600739957, -465557168, 1828121711,
+    1040461570, -1533926791, 795339140, -643537133, -608911018, 1259014333,
+    1273934584, -1391142409, -1636471062, -412036799, 1608677804, 959818011,
+    153897918, -1083539451, -464096864, 1589147775, 1345760210, -550676215,
+    1427574484, 825699363, 121447206, 1698750541, 564004168, 1805117447,
+    -498629190,
+};
+
+static const uint32_t GOLDEN_F32_IN[] = {
+    0x00000000, 0x80000000, 0x00000001, 0x807fffff, 0x3f800000, 0xbf800000,
+    0x7f7fffff, 0x7f800000, 0xff800000, 0x7fc00001, 0x3f000001, 0x40490fdb,
+    0x3f9105b0, 0x3fa68c90, 0xbfce9de0, 0x3ef08730, 0x3ee35a40, 0xbfc67fe8,
+    0x3ea16a40, 0x3fc73738, 0xbfd0df1c, 0xbf64ece0, 0x3f8f5ee8, 0x3f6c14e0,
+    0xbefca930, 0xbfa3e9ac, 0xbf5f2518, 0x3fc33520, 0xbedd35d0, 0x3f8cf658,
+    0x3f5f09e8, 0xbfd1a894, 0x3f7392d8, 0x3faf43fc, 0x3e7365c0, 0xbf92c000,
+    0x3fce88e4, 0xbecccf60, 0xbf97037c, 0x3f372808, 0x3fa443f4, 0x3ffff648,
+    0xbffe1b60, 0x3f21ee38, 0xbff4c5d4, 0xbf17a778, 0xbfc80a2c, 0x3d366e80,
+    0x3fd31f90, 0x3ff8c284, 0xbf482d30, 0xbf243c98, 0x3fdc24a8, 0x3fce5fec,
+    0xbfa156dc, 0x3f662200, 0x3ed1f9f0, 0xbea46860, 0xbf1fd158, 0x3ff46f04,
+    0x3f8a6e94, 0x3f1fb0b8, 0xbe4d4a40, 0xbda901c0,
+};
+
+static const uint32_t GOLDEN_U8_OUT[] = {
+    0xbf800000, 0xbf7e0000, 0xbf7c0000, 0xbf7a0000, 0xbf780000, 0xbf760000,
+    0xbf740000, 0xbf720000, 0xbf700000, 0xbf6e0000, 0xbf6c0000, 0xbf6a0000,
+    0xbf680000, 0xbf660000, 0xbf640000, 0xbf620000, 0xbf600000, 0xbf5e0000,
+    0xbf5c0000, 0xbf5a0000, 0xbf580000, 0xbf560000, 0xbf540000, 0xbf520000,
+    0xbf500000, 0xbf4e0000, 0xbf4c0000, 0xbf4a0000, 0xbf480000, 0xbf460000,
+    0xbf440000, 0xbf420000, 0xbf400000, 0xbf3e0000, 0xbf3c0000, 0xbf3a0000,
+    0xbf380000, 0xbf360000, 0xbf340000, 0xbf320000, 0xbf300000, 0xbf2e0000,
+    0xbf2c0000, 0xbf2a0000, 0xbf280000, 0xbf260000, 0xbf240000, 0xbf220000,
+    0xbf200000, 0xbf1e0000, 0xbf1c0000, 0xbf1a0000, 0xbf180000, 0xbf160000,
+    0xbf140000, 0xbf120000, 0xbf100000, 0xbf0e0000, 0xbf0c0000, 0xbf0a0000,
+    0xbf080000, 0xbf060000, 0xbf040000, 0xbf020000, 0xbf000000, 0xbefc0000,
+    0xbef80000, 0xbef40000, 0xbef00000, 0xbeec0000, 0xbee80000, 0xbee40000,
+    0xbee00000, 0xbedc0000, 0xbed80000, 0xbed40000, 0xbed00000, 0xbecc0000,
+    0xbec80000, 0xbec40000, 0xbec00000, 0xbebc0000, 0xbeb80000, 0xbeb40000,
+    0xbeb00000, 0xbeac0000, 0xbea80000, 0xbea40000, 0xbea00000, 0xbe9c0000,
+    0xbe980000, 0xbe940000, 0xbe900000, 0xbe8c0000, 0xbe880000, 0xbe840000,
+    0xbe800000, 0xbe780000, 0xbe700000, 0xbe680000, 0xbe600000, 0xbe580000,
+    0xbe500000, 0xbe480000, 0xbe400000, 0xbe380000, 0xbe300000, 0xbe280000,
+    0xbe200000, 0xbe180000, 0xbe100000, 0xbe080000, 0xbe000000, 0xbdf00000,
+    0xbde00000, 0xbdd00000, 0xbdc00000, 0xbdb00000, 0xbda00000, 0xbd900000,
+    0xbd800000, 0xbd600000, 0xbd400000, 0xbd200000, 0xbd000000, 0xbcc00000,
+    0xbc800000, 0xbc000000, 0x00000000, 0x3c000000, 0x3c800000, 0x3cc00000,
+    0x3d000000, 0x3d200000, 0x3d400000, 0x3d600000, 0x3d800000, 0x3d900000,
+    0x3da00000, 0x3db00000, 0x3dc00000, 0x3dd00000, 0x3de00000, 0x3df00000,
+    0x3e000000, 0x3e080000, 0x3e100000, 0x3e180000, 0x3e200000, 0x3e280000,
+    0x3e300000, 0x3e380000, 0x3e400000, 0x3e480000, 0x3e500000, 0x3e580000,
+    0x3e600000, 0x3e680000, 0x3e700000, 0x3e780000, 0x3e800000, 0x3e840000,
+    0x3e880000, 0x3e8c0000, 0x3e900000, 0x3e940000, 0x3e980000, 0x3e9c0000,
+    0x3ea00000, 0x3ea40000, 0x3ea80000, 0x3eac0000, 0x3eb00000, 0x3eb40000,
+    0x3eb80000, 0x3ebc0000, 0x3ec00000, 0x3ec40000, 0x3ec80000, 0x3ecc0000,
+    0x3ed00000, 0x3ed40000, 0x3ed80000, 0x3edc0000, 0x3ee00000, 0x3ee40000,
+    0x3ee80000, 0x3eec0000, 0x3ef00000, 0x3ef40000, 0x3ef80000, 0x3efc0000,
+    0x3f000000, 0x3f020000, 0x3f040000, 0x3f060000, 0x3f080000, 0x3f0a0000,
+    0x3f0c0000, 0x3f0e0000, 0x3f100000, 0x3f120000, 0x3f140000, 0x3f160000,
+    0x3f180000, 0x3f1a0000, 0x3f1c0000, 0x3f1e0000, 0x3f200000, 0x3f220000,
+    0x3f240000, 0x3f260000, 0x3f280000, 0x3f2a0000, 0x3f2c0000, 0x3f2e0000,
+    0x3f300000, 0x3f320000, 0x3f340000, 0x3f360000, 0x3f380000, 0x3f3a0000,
+    0x3f3c0000, 0x3f3e0000, 0x3f400000, 0x3f420000, 0x3f440000, 0x3f460000,
+    0x3f480000, 0x3f4a0000, 0x3f4c0000, 0x3f4e0000, 0x3f500000, 0x3f520000,
+    0x3f540000, 0x3f560000, 0x3f580000, 0x3f5a0000, 0x3f5c0000, 0x3f5e0000,
+    0x3f600000, 0x3f620000, 0x3f640000, 0x3f660000, 0x3f680000, 0x3f6a0000,
+    0x3f6c0000, 0x3f6e0000, 0x3f700000, 0x3f720000, 0x3f740000, 0x3f760000,
+    0x3f780000, 0x3f7a0000, 0x3f7c0000, 0x3f7e0000,
+};
+
+static const uint32_t GOLDEN_S16_OUT[] = {
+    0xbf800000, 0xbf7ffe00, 0xbf000000, 0xbc008000, 0xbc000000, 0xbbff0000,
+    0xb8800000, 0xb8000000, 0x00000000, 0x38000000, 0x38800000, 0x3bff0000,
+    0x3c000000, 0x3c008000, 0x3efffc00, 0x3f000000, 0x3f7ffc00, 0x3f7ffe00,
+    0xbf0dc800, 0xbf070c00, 0xbf677c00, 0x3d912000, 0x3f6f6200, 0x3f149200,
+    0x3f653600, 0xbe7b4800, 0x3e502000, 0x3e01a000, 0xbf183800, 0xbe31f800,
+    0xbf017000, 0x3f37c000, 0xbf4d2000, 0x3f2bac00, 0xb9f00000, 0x3e8cbc00,
+    0x3f6fa600, 0x3f50b400, 0xbe726000, 0x3f508e00, 0xbef47800, 0x3f761e00,
+    0x3db83000, 0xbe89d400, 0x3f436000, 0x3f03f600, 0x3ee65000, 0xbed98000,
+    0x3f052200, 0x3f1ec200, 0xbdea6000, 0x3eada000, 0x3ebc6400, 0xbea0ec00,
+    0x3f6b1400, 0x3e704800, 0xbe7f1800, 0xbf142800, 0xbd3d2000, 0x3f79cc00,
+    0x3f236000, 0xbf225000, 0x3e41a800, 0xbee17000,
+};
+
+static const uint32_t GOLDEN_S32_OUT[] = {
+    0xbf800000, 0xbf800000, 0xbf7fffff, 0xbf7fffff, 0xbf7fffff, 0xbc000002,
+    0xbc000000, 0xb0000000, 0x00000000, 0x30000000, 0x3bffffff, 0x3c000000,
+    0x3c000000, 0x3c000001, 0x3c000002, 0x3f000000, 0x3f000000, 0x3f000001,
+    0x3f7fffff, 0x3f7fffff, 0x3f7fffff, 0x3f800000, 0x3f800000, 0x3f5bae4c,
+    0x3f08eba0, 0xbdafda7d, 0x3ee71898, 0xbeac43b2, 0x3ed9c155, 0x3e1bc1a5,
+    0x3f05d920, 0xbdea8b3e, 0xbf168ba7, 0xbdb0541a, 0x3eaffd18, 0x3d2c1c7e,
+    0x3f3ed2b5, 0xbe5dfeb6, 0x3f59edd9, 0x3ef810bc, 0xbf36dbbb, 0x3ebd9fa6,
+    0xbe996e64, 0xbe912cfb, 0x3f161611, 0x3f17dd66, 0xbf25d64c, 0xbf431522,
+    0xbe447976, 0x3f3fc4f3, 0x3ee4d6a4, 0x3d92c4bc, 0xbf012b00, 0xbe5d4c73,
+    0x3f3d70f1, 0x3f206d58, 0xbe834a9c, 0x3f2a2e1e, 0x3ec4dcb1, 0x3d67a465,
+    0x3f4a81c1, 0x3e867815, 0x3f572fd0, 0xbe6dc3d2,
+};
+
+static const uint32_t GOLDEN_F32_OUT[] = {
+    0x00000000, 0x80000000, 0x00000001, 0x807fffff, 0x3f800000, 0xbf800000,
+    0x7f7fffff, 0x7f800000, 0xff800000, 0x7fc00001, 0x3f000001, 0x40490fdb,
+    0x3f9105b0, 0x3fa68c90, 0xbfce9de0, 0x3ef08730, 0x3ee35a40, 0xbfc67fe8,
+    0x3ea16a40, 0x3fc73738, 0xbfd0df1c, 0xbf64ece0, 0x3f8f5ee8, 0x3f6c14e0,
+    0xbefca930, 0xbfa3e9ac, 0xbf5f2518, 0x3fc33520, 0xbedd35d0, 0x3f8cf658,
+    0x3f5f09e8, 0xbfd1a894, 0x3f7392d8, 0x3faf43fc, 0x3e7365c0, 0xbf92c000,
+    0x3fce88e4, 0xbecccf60, 0xbf97037c, 0x3f372808, 0x3fa443f4, 0x3ffff648,
+    0xbffe1b60, 0x3f21ee38, 0xbff4c5d4, 0xbf17a778, 0xbfc80a2c, 0x3d366e80,
+    0x3fd31f90, 0x3ff8c284, 0xbf482d30, 0xbf243c98, 0x3fdc24a8, 0x3fce5fec,
+    0xbfa156dc, 0x3f662200, 0x3ed1f9f0, 0xbea46860, 0xbf1fd158, 0x3ff46f04,
+    0x3f8a6e94, 0x3f1fb0b8, 0xbe4d4a40, 0xbda901c0,
+};
+
+#define GOLDEN_DOWNMIX_FRAMES 16
+
+static const uint32_t GOLDEN_DOWNMIX6_U8[] = {
+    0xc00fe72f, 0xc00ba2a3, 0xbfd76136, 0xbfced81d, 0xbf8ef40c, 0xbf866af4,
+    0xbf0d0dc7, 0xbef7f72b, 0x3c7322a4, 0x3da6f5e0, 0x3f14a6dd, 0x3f25b90e,
+    0x3f92c097, 0x3f9b49b0, 0x3fdb2dc1, 0x3fe3b6da, 0x3f5d2bed, 0x3f6e3e1e,
+    0xbffe01d3, 0xbff578ba, 0xbfb594ab, 0xbfad0b92, 0xbf5a4f04, 0xbf493cd3,
+    0xbe92e964, 0xbe618a02, 0x3e8ecb40, 0x3eb0efa2, 0x3f583ff2, 0x3f695224,
+    0x3fb48d22, 0x3fbd163a,
+};
+
+static const uint32_t GOLDEN_DOWNMIX6_S16[] = {
+    0xbfd1d629, 0xbe399b74, 0xbf6c9616, 0x3dd348d2, 0x3fac2fa6, 0xbf732d06,
+    0x3f977541, 0x3fcf4bdf, 0xbf18de70, 0xbe8f9de2, 0x3edd3c32, 0xbf3d8971,
+    0x3f006de2, 0xbee10155, 0xbf922197, 0xbcf96a10, 0x3ef6b883, 0xbeb1a095,
+    0x3f90fe33, 0x3f2e800a, 0x3f3494bd, 0x3fa1c988, 0xbf7f31d6, 0x3d612ac4,
+    0xbddb6a24, 0xbe8b89ac, 0x3f59c8c8, 0x3f9c7736, 0x3f89fda4, 0x3f54c5ce,
+    0x3e2abbd4, 0x3dc29192,
+};
+
+static const uint32_t GOLDEN_DOWNMIX6_S32[] = {
+    0xbe932208, 0xbd810892, 0x3eaae8a7, 0xbca35660, 0x3f91cd18, 0xbe98ca2e,
+    0x3f05373e, 0x3eed2c80, 0xbf754036, 0xbdba336c, 0x3ebe9ab0, 0xbfa5439b,
+    0x3db7efb8, 0x3fa1e08f, 0x3ff38b2a, 0x3f755772, 0xbf208964, 0x3d646cec,
+    0x3f2109ea, 0x3fdc42c6, 0x3ece0b42, 0x3fa227b7, 0x3f8ad506, 0x3f9e5015,
+    0x3e24f812, 0x3e4f022c, 0x3f2a36e7, 0x3e8f8eb4, 0x3dd91ebc, 0x3dc8b6d6,
+    0xbe932204, 0xbe6df63b,
+};
+
+static const uint32_t GOLDEN_DOWNMIX6_F32[] = {
+    0xbf4ce118, 0xbfc6a625, 0x3f9ce643, 0x3ecb11dc, 0x7f3504f2, 0x7f3504f2,
+    0xbf55f5a8, 0xbf735d9e, 0x3f9b0a4f, 0xbef20fa4, 0x3ec7399c, 0x400ead71,
+    0xff800000, 0x3eea154c, 0xbf53114e, 0x3f882fe2, 0x3ff520fc, 0x7fc00001,
+    0xbfe5c48b, 0x3fdb4e84, 0xc0336dae, 0x3eb0aa0a, 0xbd1ad400, 0xbfbf5494,
+    0x3fbf60e7, 0xbf9299a5, 0x7f7fffff, 0x40130823, 0x3f4c688d, 0x3faaf8bd,
+    0x3fcbecb2, 0x7f800000,
+};
+
+static const uint32_t GOLDEN_DOWNMIX8_U8[] = {
+    0xc0328d22, 0xc02c8409, 0xbfe83ff1, 0xbfdc2dc0, 0xbf56cb3f, 0xbf3ea6dd,
+    0x3e0ba591, 0x3e6c371d, 0x3f8e4f04, 0x3f9a6136, 0x400594ac, 0x400b9dc4,
+    0x3e6fce14, 0x3ea82fce, 0xc00d1870, 0xc0070f57, 0xbf9d568d, 0xbf91445c,
+    0xbe81f0ed, 0xbe23504e, 0x3f38bc2c, 0x3f50e090, 0x3fd93869, 0x3fe54a9a,
+    0x402b095d, 0x3fad1ffa, 0xc02610e7, 0xc02007cd, 0xbfcf477a, 0xbfc3354a,
+    0xbf24da52, 0xbf0cb5f0,
+};
+
+static const uint32_t GOLDEN_DOWNMIX8_S16[] = {
+    0xbfff9981, 0x3c56bd50, 0xbddb80c5, 0xbe88b86c, 0x4007ea4b, 0x3f912cb0,
+    0x3d8333d8, 0xbe439322, 0xbeb00285, 0x3eed9a2d, 0xbf7abc53, 0xbdccaff8,
+    0x3f55dd51, 0xbf384e63, 0x40056048, 0x3f745115, 0xbfff9981, 0x3c56bd50,
+    0xbddb80c5, 0xbe88b86c, 0x4007ea4b, 0x3f912cb0, 0x3d8333d8, 0xbe439322,
+    0xbeb00285, 0x3eed9a2d, 0xbf7abc53, 0xbdccaff8, 0x3f55dd51, 0xbf384e63,
+    0x40056048, 0x3f745115,
+};
+
+static const uint32_t GOLDEN_DOWNMIX8_S32[] = {
+    0x3da8a0b0, 0xbd085dab, 0x3e1f4fea, 0x3e54aa54, 0x3f635f60, 0x3fd0dc19,
+    0xbe807686, 0xbea85c0c, 0xbf0ff799, 0xbf2a6dbc, 0x3fce0da4, 0x3ee83690,
+    0xbf1f1f5a, 0x3f434bc1, 0x3fdb9ca8, 0x3f76ffc6, 0x3da8a0b0, 0xbd085dab,
+    0x3e1f4fea, 0x3e54aa54, 0x3f635f60, 0x3fd0dc19, 0xbe807686, 0xbea85c0c,
+    0xbf0ff799, 0xbf2a6dbc, 0x3fce0da4, 0x3ee83690, 0xbf1f1f5a, 0x3f434bc1,
+    0x3fdb9ca8, 0x3f76ffc6,
+};
+
+static const uint32_t GOLDEN_DOWNMIX8_F32[] = {
+    0xbe3cab1c, 0xc017355e, 0x7f3504f2, 0x3f89be8d, 0xbe0bb3e8, 0xbf0cdc46,
+    0x40003597, 0x3f1b08da, 0x3f1f4048, 0xc001f92e, 0xff800000, 0x403c220e,
+    0x3f460ebc, 0x7fc00001, 0xc024687d, 0x407f9bae, 0xbe3cab1c, 0xc017355e,
+    0x7f3504f2, 0x3f89be8d, 0xbe0bb3e8, 0xbf0cdc46, 0x40003597, 0x3f1b08da,
+    0x3f1f4048, 0xc001f92e, 0xff800000, 0x403c220e, 0x3f460ebc, 0x7fc00001,
+    0xc024687d, 0x407f9bae,
+};
+
+// clang-format on
@@ -0,0 +1,180 @@
+#include "audio-kernels.h"
+#include "kernels-golden.h"
+
+#include <iterator>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// clang-format off
+
+// odd counts leave SIMD tails behind, and the longer ones take planar input
+// over more than one chunk
+static const size_t FRAME_COUNTS[] = { 1, 3, 17, 67, 300, 1000 };
+
+// clang-format on
+
+static int g_failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        g_failures++;
+    }
+}
+
+static const char* format_name(sample_format format)
+{
+    switch (format) {
+    case sample_format::u8:
+        return "u8";
+    case sample_format::s16:
+        return "s16";
+    case sample_format::s32:
+        return "s32";
+    default:
+        return "f32";
+    }
+}
+
+// Input value i of format, and the bits swr turns it into.
+struct golden_values {
+    const void* in;
+    const uint32_t* out;
+    size_t count;
+};
+
+static golden_values golden(sample_format format)
+{
+    static uint8_t u8[256];
+    for (size_t i = 0; i < 256; i++)
+        u8[i] = (uint8_t)i;
+
+    switch (format) {
+    case sample_format::u8:
+        return { u8, GOLDEN_U8_OUT, 256 };
+    case sample_format::s16:
+        return { GOLDEN_S16_IN, GOLDEN_S16_OUT, std::size(GOLDEN_S16_IN) };
+    case sample_format::s32:
+        return { GOLDEN_S32_IN, GOLDEN_S32_OUT, std::size(GOLDEN_S32_IN) };
+    default:
+        return { GOLDEN_F32_IN, GOLDEN_F32_OUT, std::size(GOLDEN_F32_IN) };
+    }
+}
+
+static void test_convert(sample_format format, bool planar, uint32_t channels,
+    size_t frames_count)
+{
+    golden_values values = golden(format);
+    size_t sample_size = sample_format_size(format);
+
+    // interleaved sample i is value i, planar input holds the same samples
+    // one channel after the other
+    std::vector<uint8_t> src(frames_count * channels * sample_size);
+    std::vector<uint32_t> expected(frames_count * channels);
+    for (size_t frame = 0; frame < frames_count; frame++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            size_t i = frame * channels + c;
+            size_t at = planar ? c * frames_count + frame : i;
+            memcpy(&src[at * sample_size],
+                (const uint8_t*)values.in + i % values.count * sample_size,
+                sample_size);
+            expected[i] = values.out[i % values.count];
+        }
+    }
+
+    std::vector<float> dst(frames_count * channels);
+    convert_samples(dst.data(), src.data(), format, planar, channels,
+        frames_count);
+
+    char what[128];
+    snprintf(what, sizeof(what), "%s %s %uch x %zu frames matches swr",
+        format_name(format), planar ? "planar" : "interleaved", channels,
+        frames_count);
+    check(memcmp(dst.data(), expected.data(), dst.size() * sizeof(float)) == 0,
+        what);
+}
+
+static void test_downmix(sample_format format, uint32_t channels,
+    const uint32_t* expected)
+{
+    golden_values values = golden(format);
+    size_t sample_size = sample_format_size(format);
+    size_t frames_count = GOLDEN_DOWNMIX_FRAMES;
+
+    std::vector<uint8_t> src(frames_count * channels * sample_size);
+    for (size_t i = 0; i < frames_count * channels; i++)
+        memcpy(&src[i * sample_size],
+            (const uint8_t*)values.in + i * 5 % values.count * sample_size,
+            sample_size);
+
+    std::vector<float> dst(frames_count * 2);
+    downmix_samples(dst.data(), src.data(), format, channels, frames_count);
+
+    char what[128];
+    snprintf(what, sizeof(what), "%s %uch downmix matches swr",
+        format_name(format), channels);
+    check(memcmp(dst.data(), expected, dst.size() * sizeof(float)) == 0, what);
+
+    // and it adds onto whatever's there rather than overwrite it
+    std::vector<float> twice(dst);
+    for (float& sample : twice)
+        sample += sample;
+    downmix_samples(dst.data(), src.data(), format, channels, frames_count);
+
+    snprintf(what, sizeof(what), "%s %uch downmix adds onto dst",
+        format_name(format), channels);
+    check(memcmp(dst.data(), twice.data(), dst.size() * sizeof(float)) == 0,
+        what);
+}
+
+static void test_mix()
+{
+    for (size_t count : FRAME_COUNTS) {
+        std::vector<float> dst(count);
+        std::vector<float> src(count);
+        std::vector<float> expected(count);
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = (float)i / count - 0.5f;
+            src[i] = 0.25f - (float)(i % 7) / 7;
+            expected[i] = dst[i] + src[i];
+        }
+
+        mix_samples(dst.data(), src.data(), count);
+
+        char what[128];
+        snprintf(what, sizeof(what), "mixing %zu samples adds them", count);
+        check(memcmp(dst.data(), expected.data(), count * sizeof(float)) == 0,
+            what);
+    }
+}
+
+int main()
+{
+    printf("audio kernels, %s\n", mix_samples_kernel_name());
+
+    static const sample_format formats[] = { sample_format::u8,
+        sample_format::s16, sample_format::s32, sample_format::f32 };
+
+    for (sample_format format : formats)
+        for (bool planar : { false, true })
+            for (uint32_t channels = 1; channels <= 8; channels++)
+                for (size_t frames_count : FRAME_COUNTS)
+                    test_convert(format, planar, channels, frames_count);
+
+    test_downmix(sample_format::u8, 6, GOLDEN_DOWNMIX6_U8);
+    test_downmix(sample_format::s16, 6, GOLDEN_DOWNMIX6_S16);
+    test_downmix(sample_format::s32, 6, GOLDEN_DOWNMIX6_S32);
+    test_downmix(sample_format::f32, 6, GOLDEN_DOWNMIX6_F32);
+    test_downmix(sample_format::u8, 8, GOLDEN_DOWNMIX8_U8);
+    test_downmix(sample_format::s16, 8, GOLDEN_DOWNMIX8_S16);
+    test_downmix(sample_format::s32, 8, GOLDEN_DOWNMIX8_S32);
+    test_downmix(sample_format::f32, 8, GOLDEN_DOWNMIX8_F32);
+
+    test_mix();
+
+    if (g_failures)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#include "obs-stubs.h"
+
+#include <atomic>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+static std::atomic<uint64_t> g_time = 1'000'000'000;
+
+void set_bench_time(uint64_t ns)
+{
+    g_time.store(ns, std::memory_order_relaxed);
+}
+
+uint64_t os_gettime_ns(void)
+{
+    return g_time.load(std::memory_order_relaxed);
+}
+
+// only warnings and worse, anything else would just skew the numbers
+void blog(int log_level, const char* format, ...)
+{
+    if (log_level > LOG_WARNING)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
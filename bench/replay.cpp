@@ -0,0 +1,192 @@
+#include "replay.h"
+#include "audio-helpers.h"
+#include "latency-trace.h"
+#include "obs-stubs.h"
+#include "packet-recording.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// clang-format off
+
+// what OBS usually outputs, with app-audio-capture's default buffer
+#define REPLAY_RATE                     48000
+#define REPLAY_SPEAKERS                 SPEAKERS_STEREO
+#define REPLAY_BUFFER                   480'000'000
+
+// clang-format on
+
+struct replay_options {
+    const char* recording = nullptr;
+    const char* out = nullptr;
+    const char* trace = nullptr;
+    bool realtime = false;
+};
+
+static bool parse_options(int argc, char** argv, replay_options& options)
+{
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--realtime") == 0)
+            options.realtime = true;
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            options.out = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            options.trace = argv[++i];
+        else if (!options.recording && argv[i][0] != '-')
+            options.recording = argv[i];
+        else
+            return false;
+    }
+
+    return options.recording != nullptr;
+}
+
+// Pops every block that would have been output by time, as raw interleaved
+// floats into out if there is one, and as if OBS output them right away.
+static void pop_until(audio_mixer& mixer, uint64_t time, FILE* out,
+    uint64_t& blocks)
+{
+    for (uint64_t deadline = mixer.pop_deadline(); deadline < time;
+         deadline = mixer.pop_deadline()) {
+        set_bench_time(deadline + 1);
+
+        audio_mixer::block_view view = mixer.pop();
+        for (size_t i = 0; i < view.traces_count; i++)
+            latency_tracer::get().record(trace_stage::output, view.traces[i],
+                deadline + 1);
+        if (out && view.samples)
+            fwrite(view.samples, sizeof(float),
+                view.size * get_audio_channels(view.speakers), out);
+        mixer.release(view);
+        blocks++;
+    }
+}
+
+int replay_main(int argc, char** argv)
+{
+    replay_options options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr, "usage: obs-app-audio-bench replay <recording> "
+                        "[--realtime] [--out <file>] [--trace <file>]\n");
+        return 1;
+    }
+
+    packet_reader reader;
+    if (!reader.open(options.recording)) {
+        fprintf(stderr, "%s isn't a packet recording\n", options.recording);
+        return 1;
+    }
+
+    FILE* out = nullptr;
+    if (options.out && !(out = fopen(options.out, "wb"))) {
+        fprintf(stderr, "couldn't open %s\n", options.out);
+        return 1;
+    }
+
+    packet_record record;
+    std::vector<uint8_t> packet;
+    if (!reader.next(record, packet)) {
+        fprintf(stderr, "%s has no packets\n", options.recording);
+        if (out)
+            fclose(out);
+        return 1;
+    }
+
+    // the mixer's timeline starts where the recording does
+    uint64_t first = record.arrival;
+    set_bench_time(first);
+
+    audio_mixer mixer;
+    mixer.set_format(REPLAY_RATE, REPLAY_SPEAKERS);
+    mixer.resize(mixer.calculate_size(REPLAY_BUFFER));
+
+    audio_pipe_manager pipes;
+    pipes.set_transport(audio_transport::none);
+    std::unordered_set<uint32_t> pids;
+
+    if (options.trace)
+        latency_tracer::get().start();
+
+    uint64_t packets = 0;
+    uint64_t blocks = 0;
+    uint64_t read_ns = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    // record is only good until next() fails, a truncated one can have half
+    // a header in it
+    uint64_t last = first;
+
+    do {
+        pop_until(mixer, record.arrival, out, blocks);
+
+        if (options.realtime)
+            std::this_thread::sleep_until(
+                start + std::chrono::nanoseconds(record.arrival - first));
+
+        if (pids.insert(record.pid).second) {
+            pipes.add(record.pid);
+            pipes.set_mixers(record.pid, { &mixer });
+        }
+
+        set_bench_time(record.arrival);
+
+        auto read_start = std::chrono::steady_clock::now();
+        pipes.feed(record.pid, packet.data(), packet.size());
+        read_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - read_start)
+                       .count();
+        packets++;
+        last = record.arrival;
+    } while (reader.next(record, packet));
+
+    // whatever is still buffered behind the last packet
+    pop_until(mixer, last + REPLAY_BUFFER, out, blocks);
+
+    audio_pipe_stats total;
+    for (auto& stats : pipes.stats(&mixer)) {
+        total.discontiguous += stats.discontiguous;
+        total.format_changes += stats.format_changes;
+        total.dropped_frames += stats.dropped_frames;
+        total.rejected_frames += stats.rejected_frames;
+    }
+
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start)
+                         .count();
+    double duration = (last - first) / 1e9;
+
+    printf("replayed %s\n", options.recording);
+    printf("  %-16s %12llu\n", "packets", (unsigned long long)packets);
+    printf("  %-16s %12zu\n", "processes", pids.size());
+    printf("  %-16s %12llu\n", "blocks", (unsigned long long)blocks);
+    printf("  %-16s %12llu\n", "unsnapped",
+        (unsigned long long)total.discontiguous);
+    printf("  %-16s %12llu\n", "format changes",
+        (unsigned long long)total.format_changes);
+    printf("  %-16s %12llu\n", "frames dropped",
+        (unsigned long long)total.dropped_frames);
+    printf("  %-16s %12llu\n", "frames rejected",
+        (unsigned long long)total.rejected_frames);
+    printf("  %-16s %11.3fs\n", "duration", duration);
+    printf("  %-16s %12.0f\n", "packets/s",
+        read_ns ? packets * 1e9 / read_ns : 0);
+    printf("  %-16s %11.1fx\n", "speed",
+        elapsed > 0 ? duration / elapsed : 0);
+
+    if (options.trace) {
+        auto& tracer = latency_tracer::get();
+        tracer.stop();
+        if (!tracer.export_chrome_trace(options.trace))
+            fprintf(stderr, "couldn't write %s\n", options.trace);
+        printf("\n%s", tracer.histogram().c_str());
+    }
+
+    if (out)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// obs-app-audio-bench replay <recording> [--realtime] [--out <file>]
+//     [--trace <file>]
+//
+// Feeds a recording made with OBS_APP_AUDIO_RECORD back through the same
+// pipes and mixer the plugin uses, on the clock it was recorded on, and can
+// trace every packet's latency along the way, see latency-trace.h.
+int replay_main(int argc, char** argv);
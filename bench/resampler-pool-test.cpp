@@ -0,0 +1,161 @@
+#include "audio-helpers.h"
+#include "audio-hook-info.h"
+#include "obs-stubs.h"
+#include "swr-stubs.h"
+
+#include <iterator>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// clang-format off
+
+#define FLIPS                           10'000
+#define PIPES                           8
+
+// nanoseconds per packet, 10ms like WASAPI
+#define PACKET_DURATION                 10'000'000
+
+// clang-format on
+
+static int g_failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        g_failures++;
+    }
+}
+
+// None of them match the 48kHz stereo mixer, so every one of them needs swr.
+struct stream_format {
+    speaker_layout layout;
+    audio_format format;
+    int samples_per_sec;
+};
+
+static const stream_format FORMATS[] = {
+    { SPEAKERS_STEREO, AUDIO_FORMAT_FLOAT, 44100 },
+    { SPEAKERS_MONO, AUDIO_FORMAT_16BIT, 32000 },
+    { SPEAKERS_5POINT1, AUDIO_FORMAT_U8BIT, 22050 },
+};
+
+static constexpr size_t FORMAT_COUNT = std::size(FORMATS);
+
+static void test_pool()
+{
+    reset_swr_stub_stats();
+    {
+        resampler_pool pool;
+        resampler_pool::key k = {
+            .in_layout = AV_CH_LAYOUT_STEREO,
+            .in_format = AV_SAMPLE_FMT_FLT,
+            .in_rate = 44100,
+            .out_layout = AV_CH_LAYOUT_STEREO,
+            .out_rate = 48000,
+        };
+
+        for (int i = 0; i < FLIPS; i++)
+            pool.release(k, pool.acquire(k));
+        check(get_swr_stub_stats().allocs == 1,
+            "taking and giving back one resampler reuses it");
+
+        // more given back at once than the pool keeps
+        std::vector<SwrContext*> taken;
+        for (size_t i = 0; i < resampler_pool::MAX_IDLE + 8; i++)
+            taken.push_back(pool.acquire(k));
+        for (SwrContext* ctx : taken)
+            pool.release(k, ctx);
+
+        check(pool.idle() == resampler_pool::MAX_IDLE,
+            "the pool keeps no more than MAX_IDLE");
+        check(get_swr_stub_stats().live == resampler_pool::MAX_IDLE,
+            "resamplers past MAX_IDLE get freed");
+    }
+
+    swr_stub_stats stats = get_swr_stub_stats();
+    check(stats.live == 0 && stats.frees == stats.allocs,
+        "the pool frees what it keeps");
+}
+
+// Every pipe switches to the next format with every packet, the worst a
+// stream could do, and the resamplers they go through stay the same handful.
+static void test_flips()
+{
+    uint64_t time = 1'000'000'000;
+    set_bench_time(time);
+    reset_swr_stub_stats();
+    {
+        audio_mixer mixer;
+        mixer.set_format(48000, SPEAKERS_STEREO);
+        mixer.resize(mixer.calculate_size(480'000'000));
+
+        audio_pipe_manager pipes;
+        pipes.set_transport(audio_transport::none);
+        for (uint32_t pid = 1; pid <= PIPES; pid++) {
+            pipes.add(pid);
+            pipes.set_mixers(pid, { &mixer });
+        }
+
+        // big enough for 10ms of the widest format
+        std::vector<uint8_t> packet(sizeof(audio_metadata) + 48000 / 100 * 8 * 4);
+        uint64_t most_live = 0;
+
+        for (int flip = 0; flip < FLIPS; flip++) {
+            time += PACKET_DURATION;
+            set_bench_time(time);
+
+            for (uint32_t pid = 1; pid <= PIPES; pid++) {
+                const stream_format& f = FORMATS[(flip + pid) % FORMAT_COUNT];
+                audio_metadata md = {
+                    .magic = AUDIO_PROTOCOL_MAGIC,
+                    .version = AUDIO_PROTOCOL_VERSION,
+                    .timestamp = time,
+                    .layout = f.layout,
+                    .format = f.format,
+                    .samples_per_sec = f.samples_per_sec,
+                    .frames = (uint32_t)f.samples_per_sec / 100,
+                    .flags = 0,
+                };
+                memcpy(packet.data(), &md, sizeof(md));
+                pipes.feed(pid, packet.data(), packet.size());
+            }
+
+            while (mixer.ready_to_pop())
+                mixer.release(mixer.pop());
+
+            uint64_t live = get_swr_stub_stats().live;
+            if (live > most_live)
+                most_live = live;
+        }
+
+        swr_stub_stats stats = get_swr_stub_stats();
+        printf("  %d flips over %d pipes: %llu allocs, %llu frees, %llu most "
+               "live at once\n",
+            FLIPS, PIPES, (unsigned long long)stats.allocs,
+            (unsigned long long)stats.frees, (unsigned long long)most_live);
+
+        // at worst one per pipe per format, however many flips there were
+        check(stats.allocs <= PIPES * FORMAT_COUNT,
+            "flipping formats doesn't keep allocating resamplers");
+        check(stats.frees <= stats.allocs, "nothing gets freed twice");
+        check(most_live <= PIPES + resampler_pool::MAX_IDLE,
+            "no more resamplers live than pipes plus idle ones");
+    }
+
+    swr_stub_stats stats = get_swr_stub_stats();
+    check(stats.live == 0 && stats.frees == stats.allocs,
+        "every resampler is freed once the pipes are gone");
+}
+
+int main()
+{
+    printf("resampler pool\n");
+    test_pool();
+    test_flips();
+
+    if (g_failures)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
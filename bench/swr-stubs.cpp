@@ -0,0 +1,171 @@
+#include "swr-stubs.h"
+
+#include <algorithm>
+#include <math.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+// Declared here rather than taken from FFmpeg's headers, whose signatures
+// keep changing between versions while the ABI stays the same.
+extern "C" {
+
+struct SwrContext {
+    int in_channels;
+    int out_channels;
+    int in_rate;
+    int out_rate;
+    int compensation;
+    int compensation_distance;
+
+    // output frames produced but not yet handed out, the delay
+    double pending;
+};
+
+SwrContext* swr_alloc_set_opts(SwrContext* s, int64_t out_layout,
+    int out_format, int out_rate, int64_t in_layout, int in_format,
+    int in_rate, int log_offset, void* log_ctx);
+int swr_init(SwrContext* s);
+void swr_free(SwrContext** s);
+int swr_convert(SwrContext* s, uint8_t** out, int out_count,
+    const uint8_t** in, int in_count);
+int swr_set_compensation(SwrContext* s, int sample_delta,
+    int compensation_distance);
+int64_t swr_get_delay(SwrContext* s, int64_t base);
+int64_t av_rescale_rnd(int64_t a, int64_t b, int64_t c, int rounding);
+}
+
+// same as AVRounding's
+static constexpr int ROUND_UP = 3;
+
+static std::mutex g_mutex;
+static swr_stub_stats g_stats;
+
+swr_stub_stats get_swr_stub_stats()
+{
+    std::lock_guard lock = std::lock_guard(g_mutex);
+    return g_stats;
+}
+
+void reset_swr_stub_stats()
+{
+    std::lock_guard lock = std::lock_guard(g_mutex);
+    g_stats = {};
+}
+
+static int count_channels(int64_t layout)
+{
+    int channels = 0;
+    for (; layout; layout &= layout - 1)
+        channels++;
+    return channels;
+}
+
+SwrContext* swr_alloc_set_opts(SwrContext* s, int64_t out_layout, int,
+    int out_rate, int64_t in_layout, int, int in_rate, int, void*)
+{
+    if (!s) {
+        s = new SwrContext;
+
+        std::lock_guard lock = std::lock_guard(g_mutex);
+        g_stats.allocs++;
+        g_stats.live++;
+        if (g_stats.live > g_stats.max_live)
+            g_stats.max_live = g_stats.live;
+    }
+
+    *s = {
+        .in_channels = count_channels(in_layout),
+        .out_channels = count_channels(out_layout),
+        .in_rate = in_rate,
+        .out_rate = out_rate,
+        .compensation = 0,
+        .compensation_distance = 0,
+        .pending = 0,
+    };
+    return s;
+}
+
+int swr_init(SwrContext* s)
+{
+    s->compensation = 0;
+    s->compensation_distance = 0;
+    s->pending = 0;
+
+    std::lock_guard lock = std::lock_guard(g_mutex);
+    g_stats.inits++;
+    return 0;
+}
+
+void swr_free(SwrContext** s)
+{
+    if (!*s)
+        return;
+
+    delete *s;
+    *s = nullptr;
+
+    std::lock_guard lock = std::lock_guard(g_mutex);
+    g_stats.frees++;
+    g_stats.live--;
+}
+
+// Nearest neighbour from interleaved float, stretched by whatever
+// compensation was last set, which is all the drift loop needs to see.
+// Whatever doesn't fit in out is held back and counted as delay, like swr
+// does, and comes out as silence when flushed.
+int swr_convert(SwrContext* s, uint8_t** out, int out_count,
+    const uint8_t** in, int in_count)
+{
+    float* dst = (float*)out[0];
+
+    if (!in || in_count <= 0) {
+        int n = (int)std::min((double)out_count, floor(s->pending));
+        s->pending -= n;
+        memset(dst, 0, (size_t)n * s->out_channels * sizeof(float));
+        return n;
+    }
+
+    double stretch = s->compensation_distance
+        ? 1.0 + (double)s->compensation / s->compensation_distance
+        : 1.0;
+    double frames = in_count * stretch * s->out_rate / s->in_rate + s->pending;
+    int n = (int)std::min((double)out_count, floor(frames));
+    s->pending = frames - n;
+
+    const float* src = (const float*)in[0];
+    for (int frame = 0; frame < n; frame++) {
+        int from = (int)((int64_t)frame * in_count / n);
+        for (int channel = 0; channel < s->out_channels; channel++)
+            dst[frame * s->out_channels + channel]
+                = src[from * s->in_channels + channel % s->in_channels];
+    }
+    return n;
+}
+
+int swr_set_compensation(SwrContext* s, int sample_delta,
+    int compensation_distance)
+{
+    s->compensation = sample_delta;
+    s->compensation_distance = compensation_distance;
+
+    std::lock_guard lock = std::lock_guard(g_mutex);
+    g_stats.compensations++;
+    g_stats.last_compensation = sample_delta;
+    g_stats.last_compensation_distance = compensation_distance;
+    if (abs(sample_delta) > g_stats.max_compensation)
+        g_stats.max_compensation = abs(sample_delta);
+    return 0;
+}
+
+int64_t swr_get_delay(SwrContext* s, int64_t base)
+{
+    return (int64_t)ceil(s->pending * base / s->out_rate);
+}
+
+int64_t av_rescale_rnd(int64_t a, int64_t b, int64_t c, int rounding)
+{
+    if (rounding == ROUND_UP)
+        return (a * b + c - 1) / c;
+    return (a * b + c / 2) / c;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+
+// What the code under test asked of libswresample, which the tests swap out
+// for the stand-in in swr-stubs.cpp, so that they run without FFmpeg's
+// libraries and can see every context and compensation that goes through.
+struct swr_stub_stats {
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t inits = 0;
+    uint64_t live = 0;
+    uint64_t max_live = 0;
+
+    uint64_t compensations = 0;
+    int last_compensation = 0;
+    int last_compensation_distance = 0;
+    int max_compensation = 0;
+};
+
+swr_stub_stats get_swr_stub_stats();
+void reset_swr_stub_stats();
@@ -0,0 +1,209 @@
+#include "capture-registry.h"
+#include "wasapi-session-backend.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <util/platform.h>
+
+capture_registry& capture_registry::get()
+{
+    static capture_registry registry;
+    return registry;
+}
+
+capture_registry::capture_registry()
+    : m_app_manager(std::make_unique<wasapi_session_backend>())
+{
+}
+
+// Takes effect right away, so that a retargeted source doesn't have to wait
+// for the next refresh, and an unsubscribed mixer is never mixed into again.
+void capture_registry::subscribe(audio_mixer* mixer,
+    const std::string& session_name)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    auto it = m_subscribers.find(mixer);
+    if (it != m_subscribers.end() && it->second == session_name)
+        return;
+
+    std::string previous;
+    if (it != m_subscribers.end())
+        previous = std::move(it->second);
+
+    m_subscribers[mixer] = session_name;
+    if (!previous.empty())
+        sync_session(previous);
+    sync_session(session_name);
+}
+
+void capture_registry::unsubscribe(audio_mixer* mixer)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    auto it = m_subscribers.find(mixer);
+    if (it == m_subscribers.end())
+        return;
+
+    std::string session_name = std::move(it->second);
+    m_subscribers.erase(it);
+    sync_session(session_name);
+}
+
+// Module-wide rather than a per-source setting, since every source shares
+// the same receivers. Set from obs_module_load(), before any source exists.
+void capture_registry::set_transport(audio_transport transport)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    m_pipe_manager.set_transport(transport);
+}
+
+bool capture_registry::start_recording(const std::string& path)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    return m_pipe_manager.start_recording(path);
+}
+
+void capture_registry::stop_recording()
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    m_pipe_manager.stop_recording();
+}
+
+// Of every pid mixed into mixer, sorted by pid.
+std::vector<audio_pipe_stats> capture_registry::stats(
+    const audio_mixer* mixer) const
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    auto stats = m_pipe_manager.stats(mixer);
+    std::sort(stats.begin(), stats.end(),
+        [](const audio_pipe_stats& a, const audio_pipe_stats& b) {
+            return a.pid < b.pid;
+        });
+    return stats;
+}
+
+// Called from every source's update cycle, but only refreshes the sessions
+// once they're older than max_age, so sources share a single refresh. A
+// source that finds another one already at it doesn't wait its turn.
+//
+// Enumerating sessions, describing new pids and polling injectors all happen
+// outside m_mutex. It's only held to apply what changed.
+void capture_registry::update(uint64_t max_age)
+{
+    std::unique_lock refresh_lock = std::unique_lock(m_refresh_mutex,
+        std::try_to_lock);
+    if (!refresh_lock.owns_lock())
+        return;
+
+    uint64_t now = os_gettime_ns();
+    bool refreshed = false;
+    if (!m_last_refresh || now - m_last_refresh >= max_age) {
+        m_last_refresh = now;
+        refreshed = m_app_manager.refresh(m_changes) && !m_changes.empty();
+    }
+
+    std::vector<injection> injections;
+    {
+        std::lock_guard lock = std::lock_guard(m_mutex);
+
+        if (refreshed)
+            apply_changes();
+
+        injections.swap(m_injections);
+    }
+
+    for (const auto& injection : injections) {
+        if (injection.wanted)
+            m_injector.inject(injection.pid, injection.x64);
+        else
+            m_injector.forget(injection.pid);
+    }
+    m_injector.update();
+}
+
+// Callers hold m_mutex. Only touches the pids that changed. A reused pid is
+// both removed and added, so it starts over with a new pipe and injection.
+void capture_registry::apply_changes()
+{
+    m_app_manager.apply(m_changes);
+
+    for (const auto& proc : m_changes.removed)
+        sync_pid(proc.pid, proc.x64, {});
+
+    for (const auto& proc : m_changes.added)
+        sync_pid(proc.pid, proc.x64, subscribers_of(proc.session_name));
+}
+
+// Called from obs_module_unload(), which unlike static destruction isn't
+// under the loader lock, so the receivers and the io_loop's thread can be
+// joined here.
+void capture_registry::clear()
+{
+    std::lock_guard refresh_lock = std::lock_guard(m_refresh_mutex);
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    m_subscribers.clear();
+    m_pipe_manager.clear();
+    m_injector.clear();
+    m_injections.clear();
+    m_app_manager.clear();
+    m_last_refresh = 0;
+}
+
+std::unordered_map<std::string, application_manager::application>
+capture_registry::applications() const
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    return m_app_manager.applications();
+}
+
+std::vector<audio_mixer*> capture_registry::subscribers_of(
+    const std::string& session_name) const
+{
+    std::vector<audio_mixer*> mixers;
+    for (auto& [mixer, name] : m_subscribers) {
+        if (name == session_name)
+            mixers.push_back(mixer);
+    }
+    return mixers;
+}
+
+// Callers hold m_mutex. Brings every pid of one application in line with
+// whoever captures it now.
+void capture_registry::sync_session(const std::string& session_name)
+{
+    auto& apps = m_app_manager.applications();
+    auto it = apps.find(session_name);
+    if (it == apps.end())
+        return;
+
+    std::vector<audio_mixer*> mixers = subscribers_of(session_name);
+    for (auto& [pid, x64] : it->second.processes())
+        sync_pid(pid, x64, mixers);
+}
+
+// Callers hold m_mutex. A pid has a pipe for as long as some mixer captures
+// it. Injecting is left for update() to do outside m_mutex.
+void capture_registry::sync_pid(uint32_t pid, bool x64,
+    const std::vector<audio_mixer*>& mixers)
+{
+    if (mixers.empty()) {
+        if (!m_pipe_manager.contains(pid))
+            return;
+
+        m_pipe_manager.remove(pid);
+        m_injections.push_back({ pid, x64, false });
+        return;
+    }
+
+    if (m_pipe_manager.add(pid))
+        m_injections.push_back({ pid, x64, true });
+    m_pipe_manager.set_mixers(pid, mixers);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "application-manager.h"
+#include "audio-helpers.h"
+#include "audio-transport.h"
+#include "hook-injector.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process-wide, so that every source capturing the same application shares
+// one session refresh, and every pid of it gets injected and received just
+// once. Each pid is converted once and mixed into every subscribed mixer, and
+// stays captured for as long as at least one mixer still wants it.
+class capture_registry {
+public:
+    static capture_registry& get();
+
+    capture_registry(const capture_registry&) = delete;
+    capture_registry& operator=(const capture_registry&) = delete;
+
+    void subscribe(audio_mixer* mixer, const std::string& session_name);
+    void unsubscribe(audio_mixer* mixer);
+    void set_transport(audio_transport transport);
+    bool start_recording(const std::string& path);
+    void stop_recording();
+    std::vector<audio_pipe_stats> stats(const audio_mixer* mixer) const;
+    void update(uint64_t max_age);
+    void clear();
+    std::unordered_map<std::string, application_manager::application> applications() const;
+
+private:
+    capture_registry();
+
+    void apply_changes();
+    std::vector<audio_mixer*> subscribers_of(const std::string& session_name) const;
+    void sync_session(const std::string& session_name);
+    void sync_pid(uint32_t pid, bool x64, const std::vector<audio_mixer*>& mixers);
+
+    // Held by update() for the slow part, refreshing the sessions and polling
+    // the injectors, which subscribe(), stats() and applications() never have
+    // to wait on. Taken before m_mutex.
+    std::mutex m_refresh_mutex;
+    application_manager::delta m_changes;
+    hook_injector m_injector;
+    uint64_t m_last_refresh = 0;
+
+    mutable std::mutex m_mutex;
+    application_manager m_app_manager;
+    audio_pipe_manager m_pipe_manager;
+
+    // mixer to the session name it captures
+    std::unordered_map<audio_mixer*, std::string> m_subscribers;
+
+    // pids sync_pid() started or stopped capturing since the last update(),
+    // in order, for it to inject or forget outside m_mutex
+    struct injection {
+        uint32_t pid;
+        bool x64;
+        bool wanted;
+    };
+    std::vector<injection> m_injections;
+};
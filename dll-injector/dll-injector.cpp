@@ -1,5 +1,55 @@
 #include <Windows.h>
+#include <TlHelp32.h>
 
+// clang-format off
+
+// a snapshot can fail with ERROR_BAD_LENGTH while the target is loading or
+// unloading modules, which is worth another try
+#define SNAPSHOT_ATTEMPTS               5
+
+// clang-format on
+
+// Whether a module at path is loaded into pid. The remote thread's exit code
+// is only the low 32 bits of the HMODULE on 64-bit targets, so a module that
+// loads at a multiple of 4GB would look like a failure, which is why this
+// looks for it in the target instead.
+static bool module_loaded(DWORD pid, const char* path)
+{
+    wchar_t wide_path[MAX_PATH];
+    wchar_t full_path[MAX_PATH];
+    if (!MultiByteToWideChar(CP_ACP, 0, path, -1, wide_path, MAX_PATH)
+        || !GetFullPathNameW(wide_path, MAX_PATH, full_path, NULL))
+        return false;
+
+    HANDLE snapshot = INVALID_HANDLE_VALUE;
+    for (int i = 0; i < SNAPSHOT_ATTEMPTS; i++) {
+        snapshot = CreateToolhelp32Snapshot(
+            TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, pid);
+        if (snapshot != INVALID_HANDLE_VALUE
+            || GetLastError() != ERROR_BAD_LENGTH)
+            break;
+    }
+    if (snapshot == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool found = false;
+    MODULEENTRY32W entry = {};
+    entry.dwSize = sizeof(entry);
+    for (BOOL more = Module32FirstW(snapshot, &entry); more;
+        more = Module32NextW(snapshot, &entry)) {
+        if (CompareStringOrdinal(entry.szExePath, -1, full_path, -1, TRUE)
+            == CSTR_EQUAL) {
+            found = true;
+            break;
+        }
+    }
+
+    CloseHandle(snapshot);
+    return found;
+}
+
+// Exits with EXIT_SUCCESS only once the DLL has actually been loaded into the
+// target, which is how obs-app-audio tells injected pids from failed ones.
 int main(int argc, char* argv[])
 {
     if (argc <= 2)
@@ -7,6 +57,11 @@ int main(int argc, char* argv[])
 
     const char* dll_path = argv[1];
     DWORD target_pid = atol(argv[2]);
+    size_t dll_path_size = strlen(dll_path) + 1;
+    int result = EXIT_FAILURE;
+
+    LPTHREAD_START_ROUTINE load_library_func = nullptr;
+    HANDLE thread = NULL;
 
     HMODULE kernel32dll = GetModuleHandleA("kernel32.dll");
     if (!kernel32dll)
@@ -14,31 +69,33 @@ int main(int argc, char* argv[])
 
     HANDLE process = OpenProcess(PROCESS_ALL_ACCESS, FALSE, target_pid);
     if (!process)
-        goto release_kernel32dll;
+        return EXIT_FAILURE;
 
-    HANDLE load_library_param = VirtualAllocEx(process, NULL, strlen(dll_path),
+    HANDLE load_library_param = VirtualAllocEx(process, NULL, dll_path_size,
         MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
     if (!load_library_param)
         goto release_process;
 
-    WriteProcessMemory(process, load_library_param, dll_path, strlen(dll_path),
-        NULL);
+    if (!WriteProcessMemory(process, load_library_param, dll_path,
+            dll_path_size, NULL))
+        goto release_param;
 
-    auto load_library_func = (LPTHREAD_START_ROUTINE)GetProcAddress(
+    load_library_func = (LPTHREAD_START_ROUTINE)GetProcAddress(
         kernel32dll, "LoadLibraryA");
-    HANDLE thread = CreateRemoteThread(process, NULL, NULL,
+    thread = CreateRemoteThread(process, NULL, NULL,
         load_library_func,
         load_library_param, NULL, NULL);
     if (!thread)
         goto release_param;
     WaitForSingleObject(thread, INFINITE);
+
+    if (module_loaded(target_pid, dll_path))
+        result = EXIT_SUCCESS;
     CloseHandle(thread);
 
 release_param:
     VirtualFreeEx(process, load_library_param, NULL, MEM_RELEASE);
 release_process:
     CloseHandle(process);
-release_kernel32dll:
-    CloseHandle(kernel32dll);
-    return EXIT_SUCCESS;
+    return result;
 }
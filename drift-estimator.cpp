@@ -0,0 +1,34 @@
+#include "drift-estimator.h"
+
+#include <algorithm>
+
+void drift_estimator::reset()
+{
+    m_error = 0;
+    m_primed = false;
+}
+
+void drift_estimator::update(int64_t error)
+{
+    if (!m_primed) {
+        m_error = (double)error;
+        m_primed = true;
+        return;
+    }
+
+    m_error += ((double)error - m_error) * SMOOTHING;
+}
+
+int64_t drift_estimator::error() const
+{
+    return (int64_t)m_error;
+}
+
+// Samples to add (or drop, if negative) over the next second's worth of
+// output, which is what swr_set_compensation() wants.
+int drift_estimator::compensation(int sample_rate) const
+{
+    double samples = m_error * sample_rate * 1e-9;
+    double limit = sample_rate * MAX_RATIO;
+    return (int)std::clamp(samples, -limit, limit);
+}
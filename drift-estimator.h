@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+// Smooths how far a stream's sender timestamps land from where its samples
+// end up on the mixer timeline. An offset that keeps growing means the app's
+// device clock runs at a slightly different rate than OBS's does.
+class drift_estimator {
+public:
+    void reset();
+    void update(int64_t error);
+    int64_t error() const;
+    int compensation(int sample_rate) const;
+
+public:
+    // weight of each new packet, which WASAPI sends every ~10ms
+    static constexpr double SMOOTHING = 1.0 / 32;
+
+    // never stretch or squeeze a stream by more than this
+    static constexpr double MAX_RATIO = 0.005;
+
+private:
+    double m_error = 0;
+    bool m_primed = false;
+};
@@ -0,0 +1,204 @@
+#include "hook-injector.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+static bool check_file_integrity(const std::string& filepath)
+{
+    HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ | GENERIC_EXECUTE,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        return true;
+    }
+
+    blog(LOG_WARNING, "obs-app-audio file \"%s\" couldn't be loaded: %lu",
+        filepath.c_str(), GetLastError());
+
+    return false;
+}
+
+static HANDLE create_dll_injector_proc(const std::string& dll_injector_path,
+    const std::string& dll_path, DWORD pid)
+{
+    PROCESS_INFORMATION pi = { 0 };
+    STARTUPINFOA si = { 0 };
+    si.cb = sizeof(si);
+
+    char command_line[MAX_PATH * 3] = { 0 };
+    snprintf(command_line, sizeof(command_line), "\"%s\" \"%s\" %lu",
+        dll_injector_path.c_str(), dll_path.c_str(), pid);
+
+    bool success = CreateProcessA(NULL, command_line, NULL, NULL, false,
+        CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+
+    if (!success) {
+        blog(LOG_WARNING, "Failed to create DLL injector process: %lu",
+            GetLastError());
+        return NULL;
+    }
+
+    CloseHandle(pi.hThread);
+    return pi.hProcess;
+}
+
+static std::string module_file_path(const std::string& file)
+{
+    char* path = obs_module_file(file.c_str());
+    if (!path)
+        return {};
+
+    std::string absolute = std::filesystem::absolute(path).string();
+    bfree(path);
+    return absolute;
+}
+
+//---------------------------------------------------------------[ hook_injector
+
+hook_injector::~hook_injector()
+{
+    clear();
+}
+
+void hook_injector::inject(uint32_t pid, bool x64)
+{
+    auto [it, inserted] = m_entries.try_emplace(pid);
+    if (!inserted)
+        return;
+
+    it->second.x64 = x64;
+    spawn(pid, it->second);
+}
+
+void hook_injector::forget(uint32_t pid)
+{
+    auto it = m_entries.find(pid);
+    if (it == m_entries.end())
+        return;
+
+    if (it->second.process)
+        CloseHandle(it->second.process);
+    m_entries.erase(it);
+}
+
+void hook_injector::target(const std::unordered_map<uint32_t, bool>& processes)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        const uint32_t pid = it->first;
+        it++;
+        if (processes.find(pid) == processes.end())
+            forget(pid);
+    }
+
+    for (auto& [pid, x64] : processes)
+        inject(pid, x64);
+}
+
+void hook_injector::clear()
+{
+    for (auto& [pid, e] : m_entries) {
+        if (e.process)
+            CloseHandle(e.process);
+    }
+    m_entries.clear();
+}
+
+// Collects finished injectors and respawns failed ones whose backoff is up.
+// Never blocks on an injector that's still running.
+void hook_injector::update()
+{
+    uint64_t now = os_gettime_ns();
+
+    for (auto& [pid, e] : m_entries) {
+        if (e.state == injection_state::pending) {
+            DWORD exit_code = STILL_ACTIVE;
+            bool exited = GetExitCodeProcess(e.process, &exit_code);
+            if (exited && exit_code == STILL_ACTIVE)
+                continue;
+
+            CloseHandle(e.process);
+            e.process = NULL;
+            finish(pid, e, exited && exit_code == EXIT_SUCCESS);
+        } else if (e.state == injection_state::failed && e.attempts < MAX_ATTEMPTS
+            && now >= e.retry_time) {
+            spawn(pid, e);
+        }
+    }
+}
+
+bool hook_injector::contains(uint32_t pid) const
+{
+    return m_entries.find(pid) != m_entries.end();
+}
+
+size_t hook_injector::size() const
+{
+    return m_entries.size();
+}
+
+// Paths get resolved and checked once, and only looked at again after an
+// injection has failed, in case the files changed underneath us.
+hook_injector::binaries& hook_injector::get_binaries(bool x64)
+{
+    binaries& b = x64 ? m_binaries_64 : m_binaries_32;
+    if (b.checked)
+        return b;
+
+    std::string suffix = x64 ? "64" : "32";
+    b.injector_path = module_file_path("dll-injector" + suffix + ".exe");
+    b.hook_path = module_file_path("audio-hook" + suffix + ".dll");
+    b.valid = !b.injector_path.empty() && !b.hook_path.empty()
+        && check_file_integrity(b.injector_path)
+        && check_file_integrity(b.hook_path);
+    b.checked = true;
+
+    return b;
+}
+
+void hook_injector::spawn(uint32_t pid, entry& e)
+{
+#ifdef _WIN64
+    bool x64 = e.x64;
+#else
+    bool x64 = false;
+#endif
+
+    e.attempts++;
+
+    binaries& b = get_binaries(x64);
+    e.process = b.valid
+        ? create_dll_injector_proc(b.injector_path, b.hook_path, pid)
+        : NULL;
+
+    if (!e.process) {
+        finish(pid, e, false);
+        return;
+    }
+
+    e.state = injection_state::pending;
+}
+
+void hook_injector::finish(uint32_t pid, entry& e, bool success)
+{
+    if (success) {
+        e.state = injection_state::injected;
+        return;
+    }
+
+    e.state = injection_state::failed;
+    m_binaries_32.checked = false;
+    m_binaries_64.checked = false;
+
+    if (e.attempts >= MAX_ATTEMPTS) {
+        blog(LOG_WARNING, "obs-app-audio gave up hooking pid %lu after %d attempts",
+            (unsigned long)pid, e.attempts);
+        return;
+    }
+
+    uint64_t backoff = std::min(BACKOFF_MIN << (e.attempts - 1), BACKOFF_MAX);
+    e.retry_time = os_gettime_ns() + backoff;
+}
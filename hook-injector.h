@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include <Windows.h>
+
+// Keeps track of which pids have had audio-hook injected into them, so that a
+// dll-injector process only gets spawned for pids that actually need one.
+class hook_injector {
+public:
+    enum class injection_state {
+        pending,
+        injected,
+        failed,
+    };
+
+public:
+    hook_injector() = default;
+    hook_injector(const hook_injector&) = delete;
+    ~hook_injector();
+
+    hook_injector& operator=(const hook_injector&) = delete;
+
+    void inject(uint32_t pid, bool x64);
+    void forget(uint32_t pid);
+    void target(const std::unordered_map<uint32_t, bool>& processes);
+    void clear();
+    void update();
+    bool contains(uint32_t pid) const;
+    size_t size() const;
+
+public:
+    // retries start at BACKOFF_MIN and double up to BACKOFF_MAX, and stop
+    // altogether after MAX_ATTEMPTS
+    static constexpr uint64_t BACKOFF_MIN = 1'000'000'000;
+    static constexpr uint64_t BACKOFF_MAX = 30'000'000'000;
+    static constexpr int MAX_ATTEMPTS = 5;
+
+private:
+    struct entry {
+        injection_state state = injection_state::pending;
+        bool x64 = false;
+        HANDLE process = NULL;
+        int attempts = 0;
+        uint64_t retry_time = 0;
+    };
+
+    struct binaries {
+        std::string injector_path;
+        std::string hook_path;
+        bool checked = false;
+        bool valid = false;
+    };
+
+    binaries& get_binaries(bool x64);
+    void spawn(uint32_t pid, entry& e);
+    void finish(uint32_t pid, entry& e, bool success);
+
+    std::unordered_map<uint32_t, entry> m_entries;
+    binaries m_binaries_32;
+    binaries m_binaries_64;
+};
@@ -0,0 +1,214 @@
+#include "io-loop.h"
+
+#include <assert.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+// ids start at 1, so 0 is free for waking the thread up to stop
+static constexpr uint64_t WAKE_ID = 0;
+
+io_loop::io_loop() = default;
+
+io_loop::~io_loop()
+{
+    assert(!m_thread.joinable() && "io_loop destroyed without stop()");
+}
+
+void io_loop::dispatch(uint64_t id, void* overlapped, size_t bytes,
+    uint32_t error)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    // removed while the completion was queued up
+    auto it = m_registrations.find(id);
+    if (it != m_registrations.end())
+        it->second.handler(overlapped, bytes, error);
+}
+
+//--------------------------------------------------------------------[ platform
+
+#ifdef _WIN32
+
+void io_loop::stop()
+{
+    if (!m_port)
+        return;
+
+    m_stopping = true;
+    PostQueuedCompletionStatus(m_port, 0, WAKE_ID, NULL);
+    if (m_thread.joinable())
+        m_thread.join();
+
+    CloseHandle(m_port);
+    m_port = nullptr;
+    m_stopping = false;
+}
+
+// Callers hold m_mutex.
+bool io_loop::start()
+{
+    if (m_port)
+        return true;
+
+    m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (!m_port)
+        return false;
+
+    m_thread = std::thread(&io_loop::run, this);
+    return true;
+}
+
+uint64_t io_loop::add(native_handle handle, handler_t handler)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    if (!start())
+        return 0;
+
+    uint64_t id = m_next_id++;
+    if (handle && !CreateIoCompletionPort(handle, m_port, (ULONG_PTR)id, 0))
+        return 0;
+
+    m_registrations[id] = { handle, std::move(handler) };
+    return id;
+}
+
+// A handle can't be taken off a port, it just stops completing once it's
+// closed, and anything still queued for it gets dropped by dispatch().
+void io_loop::remove(uint64_t id)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+    m_registrations.erase(id);
+}
+
+bool io_loop::post(uint64_t id, void* overlapped)
+{
+    return m_port
+        && PostQueuedCompletionStatus(m_port, 0, (ULONG_PTR)id,
+            (OVERLAPPED*)overlapped);
+}
+
+void io_loop::run()
+{
+    while (!m_stopping) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped,
+            INFINITE);
+        uint32_t error = ok ? 0 : GetLastError();
+
+        // woken up to stop, or the port itself is gone
+        if (!overlapped) {
+            if (!ok)
+                break;
+            continue;
+        }
+
+        dispatch(key, overlapped, bytes, error);
+    }
+}
+
+#else
+
+void io_loop::stop()
+{
+    if (m_epoll < 0)
+        return;
+
+    m_stopping = true;
+    uint64_t one = 1;
+    ssize_t written = write(m_wake, &one, sizeof(one));
+    (void)written;
+    if (m_thread.joinable())
+        m_thread.join();
+
+    close(m_wake);
+    close(m_epoll);
+    m_wake = -1;
+    m_epoll = -1;
+    m_stopping = false;
+}
+
+// Callers hold m_mutex.
+bool io_loop::start()
+{
+    if (m_epoll >= 0)
+        return true;
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0)
+        return false;
+
+    int wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event = { .events = EPOLLIN, .data = { .u64 = WAKE_ID } };
+    if (wake < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &event) != 0) {
+        if (wake >= 0)
+            close(wake);
+        close(epoll);
+        return false;
+    }
+
+    m_epoll = epoll;
+    m_wake = wake;
+    m_thread = std::thread(&io_loop::run, this);
+    return true;
+}
+
+uint64_t io_loop::add(native_handle handle, handler_t handler)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    if (!start())
+        return 0;
+
+    uint64_t id = m_next_id++;
+    epoll_event event = { .events = EPOLLIN, .data = { .u64 = id } };
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, handle, &event) != 0)
+        return 0;
+
+    m_registrations[id] = { handle, std::move(handler) };
+    return id;
+}
+
+void io_loop::remove(uint64_t id)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    auto it = m_registrations.find(id);
+    if (it == m_registrations.end())
+        return;
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->second.handle, nullptr);
+    m_registrations.erase(it);
+}
+
+void io_loop::run()
+{
+    static constexpr int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+
+    while (!m_stopping) {
+        int count = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR)
+            break;
+
+        for (int i = 0; i < count; i++) {
+            uint64_t id = events[i].data.u64;
+            if (id == WAKE_ID)
+                continue;
+
+            uint32_t error = (events[i].events & (EPOLLERR | EPOLLHUP)) ? EIO : 0;
+            dispatch(id, nullptr, 0, error);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+
+// One thread that waits on the I/O of every registered handle at once, so the
+// thread count stays the same however many processes are being captured. On
+// Windows it's an I/O completion port, elsewhere epoll, which is only there to
+// run this without Windows. The thread is started by the first add(), and has
+// to be stopped with stop() before the io_loop goes away.
+class io_loop {
+public:
+#ifdef _WIN32
+    using native_handle = void*;
+#else
+    using native_handle = int;
+#endif
+
+    // On Windows, called with each overlapped operation on the handle as it
+    // completes. Elsewhere, called with overlapped null whenever the handle
+    // is readable. error is 0 if all went well.
+    using handler_t = std::function<void(void* overlapped, size_t bytes,
+        uint32_t error)>;
+
+public:
+    io_loop();
+    io_loop(const io_loop&) = delete;
+    ~io_loop();
+
+    io_loop& operator=(const io_loop&) = delete;
+
+    // Returns the id to remove it by, or 0 if it couldn't be registered. On
+    // Windows the handle can be null, for a handler that's only ever called
+    // through post().
+    uint64_t add(native_handle handle, handler_t handler);
+
+    // The handler won't be called again once this returns, and a call that
+    // is already underway gets waited on, so it can't be called from inside
+    // a handler. On Windows, operations still in flight are the caller's to
+    // cancel and wait on before freeing their OVERLAPPED.
+    void remove(uint64_t id);
+
+#ifdef _WIN32
+    // Queues up a call to id's handler with overlapped, no bytes and no
+    // error, as if an operation on its handle had just completed. For
+    // handing work over to the io_loop's thread from any other.
+    bool post(uint64_t id, void* overlapped);
+#endif
+
+    // Joins the thread, once every handle has been removed. Joining blocks
+    // on the thread exiting, which DllMain can't do under the loader lock,
+    // so this is for obs_module_unload() rather than static destruction. The
+    // next add() starts it over.
+    void stop();
+
+private:
+    bool start();
+    void run();
+    void dispatch(uint64_t id, void* overlapped, size_t bytes, uint32_t error);
+
+    struct registration {
+        native_handle handle;
+        handler_t handler;
+    };
+
+#ifdef _WIN32
+    native_handle m_port = nullptr;
+#else
+    int m_epoll = -1;
+    int m_wake = -1;
+#endif
+
+    // held while a handler runs
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, registration> m_registrations;
+    uint64_t m_next_id = 1;
+
+    std::atomic<bool> m_stopping = false;
+    std::thread m_thread;
+};
@@ -0,0 +1,270 @@
+#include "latency-trace.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unordered_map>
+
+// clang-format off
+
+// histogram buckets, in milliseconds, the last one takes everything longer
+#define HISTOGRAM_BUCKET                25
+#define HISTOGRAM_BUCKETS               40
+
+// clang-format on
+
+static const char* STAGE_NAMES[] = { "hook", "receipt", "mix", "output" };
+
+// Hands the thread's buffer back once the thread exits.
+struct thread_buffer_owner {
+    latency_tracer::thread_buffer* buffer = nullptr;
+
+    ~thread_buffer_owner()
+    {
+        if (buffer)
+            buffer->owned.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local thread_buffer_owner t_owner;
+
+latency_tracer& latency_tracer::get()
+{
+    static latency_tracer tracer;
+    return tracer;
+}
+
+void latency_tracer::start()
+{
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+    m_tracing.store(true, std::memory_order_release);
+}
+
+void latency_tracer::stop()
+{
+    m_tracing.store(false, std::memory_order_release);
+}
+
+bool latency_tracer::tracing() const
+{
+    return m_tracing.load(std::memory_order_relaxed);
+}
+
+void latency_tracer::record(trace_stage stage, uint64_t id, uint64_t time)
+{
+    if (!tracing() || id == 0)
+        return;
+
+    thread_buffer* buffer = t_owner.buffer;
+    if (!buffer && !(buffer = t_owner.buffer = acquire_buffer()))
+        return;
+
+    // the first event since start() throws out the last trace's
+    uint32_t generation = m_generation.load(std::memory_order_acquire);
+    size_t size = buffer->size.load(std::memory_order_relaxed);
+    if (buffer->generation.load(std::memory_order_relaxed) != generation) {
+        buffer->size.store(0, std::memory_order_release);
+        buffer->generation.store(generation, std::memory_order_release);
+        size = 0;
+    }
+
+    if (size >= THREAD_CAPACITY)
+        return;
+
+    buffer->events[size] = { time, id, stage };
+    buffer->size.store(size + 1, std::memory_order_release);
+}
+
+// Reuses a buffer whose thread is gone and whose events are from an earlier
+// trace if there is one, so that threads coming and going don't keep adding
+// more.
+latency_tracer::thread_buffer* latency_tracer::acquire_buffer()
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    uint32_t generation = m_generation.load(std::memory_order_acquire);
+    for (auto& buffer : m_buffers) {
+        if (buffer->generation.load(std::memory_order_acquire) == generation)
+            continue;
+
+        bool owned = false;
+        if (buffer->owned.compare_exchange_strong(owned, true,
+                std::memory_order_acq_rel)) {
+            buffer->size.store(0, std::memory_order_release);
+            return buffer.get();
+        }
+    }
+
+    auto buffer = std::make_unique<thread_buffer>();
+    buffer->events = std::make_unique<event[]>(THREAD_CAPACITY);
+    buffer->owned.store(true, std::memory_order_relaxed);
+    buffer->generation.store(generation, std::memory_order_relaxed);
+
+    m_buffers.push_back(std::move(buffer));
+    return m_buffers.back().get();
+}
+
+// Every packet of the current trace, by when the app released it. A packet
+// that spans several blocks gets output several times, but only the first
+// counts, since that's when it starts being heard.
+std::vector<latency_tracer::packet_times> latency_tracer::collect() const
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    uint32_t generation = m_generation.load(std::memory_order_acquire);
+    std::unordered_map<uint64_t, packet_times> packets;
+
+    for (auto& buffer : m_buffers) {
+        if (buffer->generation.load(std::memory_order_acquire) != generation)
+            continue;
+
+        size_t size = buffer->size.load(std::memory_order_acquire);
+        for (size_t i = 0; i < size; i++) {
+            const event& e = buffer->events[i];
+
+            auto [it, inserted] = packets.try_emplace(e.id);
+            packet_times& p = it->second;
+            if (inserted)
+                p = { .id = e.id, .times = {} };
+
+            uint64_t& time = p.times[(size_t)e.stage];
+            if (!time || e.time < time)
+                time = e.time;
+        }
+    }
+
+    std::vector<packet_times> sorted;
+    sorted.reserve(packets.size());
+    for (auto& [id, p] : packets)
+        sorted.push_back(p);
+    std::sort(sorted.begin(), sorted.end(),
+        [](const packet_times& a, const packet_times& b) {
+            return a.times[(size_t)trace_stage::hook] < b.times[(size_t)trace_stage::hook];
+        });
+    return sorted;
+}
+
+bool latency_tracer::export_chrome_trace(const std::string& path) const
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+
+    auto packets = collect();
+    uint64_t origin = packets.empty() ? 0 : packets.front().times[0];
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+    for (auto& p : packets) {
+        uint32_t pid = (uint32_t)(p.id >> 32);
+
+        // each stretch between two stages it made it through
+        size_t from = 0;
+        while (from < (size_t)trace_stage::count && !p.times[from])
+            from++;
+
+        for (size_t to = from + 1; to < (size_t)trace_stage::count; to++) {
+            if (!p.times[to] || p.times[to] < p.times[from])
+                continue;
+
+            double begin = (p.times[from] - origin) / 1e3;
+            double end = (p.times[to] - origin) / 1e3;
+            fprintf(file,
+                "%s{\"name\":\"%s-%s\",\"cat\":\"latency\",\"ph\":\"b\","
+                "\"id\":\"0x%" PRIx64 "\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f},\n"
+                "{\"name\":\"%s-%s\",\"cat\":\"latency\",\"ph\":\"e\","
+                "\"id\":\"0x%" PRIx64 "\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+                first ? "" : ",\n", STAGE_NAMES[from], STAGE_NAMES[to], p.id,
+                pid, pid, begin, STAGE_NAMES[from], STAGE_NAMES[to], p.id, pid,
+                pid, end);
+            first = false;
+            from = to;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+std::string latency_tracer::histogram() const
+{
+    auto packets = collect();
+
+    struct span {
+        const char* name;
+        trace_stage from;
+        trace_stage to;
+        std::vector<uint64_t> durations;
+    };
+
+    span spans[] = {
+        { "hook-receipt", trace_stage::hook, trace_stage::receipt, {} },
+        { "receipt-mix", trace_stage::receipt, trace_stage::mix, {} },
+        { "mix-output", trace_stage::mix, trace_stage::output, {} },
+        { "hook-output", trace_stage::hook, trace_stage::output, {} },
+    };
+
+    for (auto& p : packets) {
+        for (auto& s : spans) {
+            uint64_t from = p.times[(size_t)s.from];
+            uint64_t to = p.times[(size_t)s.to];
+            if (from && to && to >= from)
+                s.durations.push_back(to - from);
+        }
+    }
+
+    std::string text;
+    char line[256];
+
+    snprintf(line, sizeof(line), "%zu packets traced, in ms:\n",
+        packets.size());
+    text += line;
+    snprintf(line, sizeof(line), "  %-14s %8s %8s %8s %8s %8s\n", "", "count",
+        "p50", "p90", "p99", "max");
+    text += line;
+
+    for (auto& s : spans) {
+        auto& d = s.durations;
+        std::sort(d.begin(), d.end());
+
+        auto percentile = [&](double p) {
+            return d.empty() ? 0 : d[std::min(d.size() - 1, (size_t)(p * d.size()))] / 1e6;
+        };
+
+        snprintf(line, sizeof(line), "  %-14s %8zu %8.1f %8.1f %8.1f %8.1f\n",
+            s.name, d.size(), percentile(0.5), percentile(0.9),
+            percentile(0.99), d.empty() ? 0 : d.back() / 1e6);
+        text += line;
+    }
+
+    // only all the way through, that's the one the buffer presets add to
+    auto& total = spans[3].durations;
+    if (total.empty())
+        return text;
+
+    size_t buckets[HISTOGRAM_BUCKETS] = {};
+    for (uint64_t d : total) {
+        size_t bucket = (size_t)(d / 1'000'000 / HISTOGRAM_BUCKET);
+        buckets[std::min(bucket, (size_t)HISTOGRAM_BUCKETS - 1)]++;
+    }
+
+    size_t most = *std::max_element(std::begin(buckets), std::end(buckets));
+    text += "hook-output:\n";
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (!buckets[i])
+            continue;
+
+        std::string bar((buckets[i] * 40 + most - 1) / most, '#');
+        if (i == HISTOGRAM_BUCKETS - 1)
+            snprintf(line, sizeof(line), "  %4zums+     %8zu %s\n",
+                i * HISTOGRAM_BUCKET, buckets[i], bar.c_str());
+        else
+            snprintf(line, sizeof(line), "  %4zu-%-4zums %8zu %s\n",
+                i * HISTOGRAM_BUCKET, (i + 1) * HISTOGRAM_BUCKET, buckets[i],
+                bar.c_str());
+        text += line;
+    }
+
+    return text;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Where a traced packet has got to. hook is when the app released the
+// buffer, which is the timestamp the hook sent along with it.
+enum class trace_stage : uint32_t {
+    hook,
+    receipt,
+    mix,
+    output,
+    count,
+};
+
+// Packet ids are the pid in the upper half and the pipe's own count in the
+// lower half, 0 means untraced.
+inline uint64_t make_trace_id(uint32_t pid, uint32_t sequence)
+{
+    return ((uint64_t)pid << 32) | sequence;
+}
+
+// Process-wide, and off unless started. Every thread that records gets a
+// fixed-size buffer of its own, so recording never takes a lock or
+// allocates past the first event, and a buffer that fills up just stops
+// recording. Reading the buffers back is meant for after stop().
+class latency_tracer {
+public:
+    static latency_tracer& get();
+
+    latency_tracer(const latency_tracer&) = delete;
+    latency_tracer& operator=(const latency_tracer&) = delete;
+
+    // Starts over, dropping whatever was traced before.
+    void start();
+    void stop();
+    bool tracing() const;
+
+    void record(trace_stage stage, uint64_t id, uint64_t time);
+
+    // Every traced packet as async events in Chrome's trace event format,
+    // one per stage it went through, for chrome://tracing or Perfetto.
+    bool export_chrome_trace(const std::string& path) const;
+
+    // How long packets took from each stage to the next and all the way
+    // through, as percentiles and a histogram.
+    std::string histogram() const;
+
+public:
+    // events per thread, a few minutes' worth at 100 packets a second
+    static constexpr size_t THREAD_CAPACITY = 1 << 16;
+
+private:
+    struct event {
+        uint64_t time;
+        uint64_t id;
+        trace_stage stage;
+    };
+
+    struct thread_buffer {
+        // only ever written by the thread that owns it
+        std::atomic<size_t> size = 0;
+        std::atomic<uint32_t> generation = 0;
+        std::atomic<bool> owned = false;
+        std::unique_ptr<event[]> events;
+    };
+
+    struct packet_times {
+        uint64_t id;
+        uint64_t times[(size_t)trace_stage::count];
+    };
+
+    latency_tracer() = default;
+
+    thread_buffer* acquire_buffer();
+    std::vector<packet_times> collect() const;
+
+    std::atomic<bool> m_tracing = false;
+    std::atomic<uint32_t> m_generation = 0;
+
+    // buffers outlive their threads, and get handed to the next new thread
+    // once the events in them belong to a finished trace
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<thread_buffer>> m_buffers;
+
+    friend struct thread_buffer_owner;
+};
@@ -0,0 +1,164 @@
+#include "message-ring.h"
+
+#include <string.h>
+
+#define RECORD_PADDING 0x1
+
+struct message_record {
+    uint32_t size;
+    uint32_t flags;
+};
+
+static constexpr size_t DATA_OFFSET = (sizeof(message_ring_header) + 63) & ~(size_t)63;
+
+static inline size_t record_size(size_t size)
+{
+    return (sizeof(message_record) + size + 7) & ~(size_t)7;
+}
+
+size_t message_ring::required_size(size_t capacity)
+{
+    return DATA_OFFSET + capacity;
+}
+
+// capacity has to be a multiple of 8
+void message_ring::init(void* memory, size_t capacity)
+{
+    m_header = (message_ring_header*)memory;
+    m_data = (uint8_t*)memory + DATA_OFFSET;
+    m_capacity = capacity;
+
+    m_header->capacity = capacity;
+    m_header->write_pos.store(0, std::memory_order_relaxed);
+    m_header->read_pos.store(0, std::memory_order_relaxed);
+    m_header->sleeping.store(0, std::memory_order_release);
+}
+
+bool message_ring::attach(void* memory, size_t size)
+{
+    auto* header = (message_ring_header*)memory;
+    uint64_t capacity = std::atomic_ref(header->capacity)
+                            .load(std::memory_order_relaxed);
+    if (size < DATA_OFFSET || capacity == 0 || capacity > size - DATA_OFFSET
+        || capacity % 8 != 0)
+        return false;
+
+    m_header = header;
+    m_data = (uint8_t*)memory + DATA_OFFSET;
+    m_capacity = capacity;
+    return true;
+}
+
+bool message_ring::valid() const
+{
+    return m_header != nullptr;
+}
+
+bool message_ring::write(const uint8_t* header, size_t header_size,
+    const uint8_t* data, size_t data_size, bool& needs_wake)
+{
+    needs_wake = false;
+
+    uint64_t capacity = m_capacity;
+    size_t size = header_size + data_size;
+    size_t needed = record_size(size);
+
+    uint64_t write_pos = m_header->write_pos.load(std::memory_order_relaxed);
+    uint64_t read_pos = m_header->read_pos.load(std::memory_order_acquire);
+
+    // messages never wrap, the tail end gets skipped over instead
+    uint64_t offset = write_pos % capacity;
+    uint64_t padding = capacity - offset < needed ? capacity - offset : 0;
+
+    if (write_pos + padding + needed - read_pos > capacity)
+        return false;
+
+    if (padding) {
+        auto* pad = (message_record*)(m_data + offset);
+        pad->size = (uint32_t)(padding - sizeof(message_record));
+        pad->flags = RECORD_PADDING;
+        write_pos += padding;
+        offset = 0;
+    }
+
+    auto* record = (message_record*)(m_data + offset);
+    record->size = (uint32_t)size;
+    record->flags = 0;
+    if (header_size)
+        memcpy(record + 1, header, header_size);
+    if (data_size)
+        memcpy((uint8_t*)(record + 1) + header_size, data, data_size);
+
+    m_header->write_pos.store(write_pos + needed, std::memory_order_release);
+
+    // pairs with the fence in prepare_sleep, so that either the reader sees
+    // the new write_pos or the writer sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_header->sleeping.load(std::memory_order_relaxed)) {
+        m_header->sleeping.store(0, std::memory_order_relaxed);
+        needs_wake = true;
+    }
+
+    return true;
+}
+
+size_t message_ring::read(const callback_t& callback)
+{
+    uint64_t capacity = m_capacity;
+
+    uint64_t read_pos = m_header->read_pos.load(std::memory_order_relaxed);
+    uint64_t write_pos = m_header->write_pos.load(std::memory_order_acquire);
+
+    size_t count = 0;
+    while (read_pos != write_pos) {
+        uint64_t offset = read_pos % capacity;
+        auto* record = (message_record*)(m_data + offset);
+
+        // The writer could be another process, so each field is read exactly
+        // once, and only what has been checked is used. A writer gone
+        // haywire gets everything it wrote thrown away.
+        uint32_t message_size = 0;
+        uint32_t flags = 0;
+        if (offset % 8 == 0) {
+            message_size = std::atomic_ref(record->size)
+                               .load(std::memory_order_relaxed);
+            flags = std::atomic_ref(record->flags)
+                        .load(std::memory_order_relaxed);
+        }
+
+        uint64_t size = record_size(message_size);
+        if (offset % 8 != 0 || size > capacity - offset) {
+            m_header->read_pos.store(write_pos, std::memory_order_release);
+            break;
+        }
+
+        if (!(flags & RECORD_PADDING)) {
+            callback((uint8_t*)(record + 1), message_size);
+            count++;
+        }
+
+        read_pos += size;
+        m_header->read_pos.store(read_pos, std::memory_order_release);
+    }
+
+    return count;
+}
+
+bool message_ring::prepare_sleep()
+{
+    m_header->sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t read_pos = m_header->read_pos.load(std::memory_order_relaxed);
+    if (m_header->write_pos.load(std::memory_order_acquire) != read_pos) {
+        m_header->sleeping.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void message_ring::finish_sleep()
+{
+    m_header->sleeping.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+struct message_ring_header {
+    // only read once, by attach(), the other side could change it later on
+    uint64_t capacity;
+
+    // both only ever grow, and are taken modulo capacity
+    alignas(64) std::atomic<uint64_t> write_pos;
+    alignas(64) std::atomic<uint64_t> read_pos;
+
+    // set by the reader right before it goes to sleep, so the writer only
+    // has to wake it when it actually needs waking
+    std::atomic<uint32_t> sleeping;
+};
+
+// Single-producer/single-consumer ring of variable-sized messages laid over
+// memory owned by somebody else, so the same code runs in shared memory and
+// on the heap. Messages never wrap around the end, so the reader always gets
+// each of them in one contiguous piece. How the reader gets woken up is left
+// to the owner.
+class message_ring {
+public:
+    using callback_t = std::function<void(uint8_t*, size_t)>;
+
+public:
+    static size_t required_size(size_t capacity);
+
+    void init(void* memory, size_t capacity);
+    bool attach(void* memory, size_t size);
+    bool valid() const;
+
+    // Writes header and data as one message, or drops it and returns false
+    // if there's no room. needs_wake tells the caller to wake the reader.
+    bool write(const uint8_t* header, size_t header_size,
+        const uint8_t* data, size_t data_size, bool& needs_wake);
+
+    // Hands every complete message to callback, returns how many there were.
+    size_t read(const callback_t& callback);
+
+    // Marks the reader as about to sleep. Returns false, and stays awake, if
+    // something got written in the meantime.
+    bool prepare_sleep();
+    void finish_sleep();
+
+private:
+    message_ring_header* m_header = nullptr;
+    uint8_t* m_data = nullptr;
+    uint64_t m_capacity = 0;
+};
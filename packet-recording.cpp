@@ -0,0 +1,116 @@
+#include "packet-recording.h"
+
+//-------------------------------------------------------------[ packet_recorder
+
+packet_recorder::~packet_recorder()
+{
+    stop();
+}
+
+bool packet_recorder::start(const std::string& path)
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    if (m_file)
+        return false;
+
+    m_file = fopen(path.c_str(), "wb");
+    if (!m_file)
+        return false;
+
+    packet_recording_header header = {
+        .magic = PACKET_RECORDING_MAGIC,
+        .version = PACKET_RECORDING_VERSION,
+    };
+    if (fwrite(&header, sizeof(header), 1, m_file) != 1) {
+        close();
+        return false;
+    }
+
+    m_recording.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void packet_recorder::stop()
+{
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    close();
+}
+
+// Callers hold m_mutex.
+void packet_recorder::close()
+{
+    m_recording.store(false, std::memory_order_relaxed);
+    if (m_file) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool packet_recorder::recording() const
+{
+    return m_recording.load(std::memory_order_relaxed);
+}
+
+// Goes through stdio's buffer, so most packets never make a syscall.
+void packet_recorder::write(uint32_t pid, uint64_t arrival,
+    const uint8_t* packet, size_t size)
+{
+    if (!recording())
+        return;
+
+    std::lock_guard lock = std::lock_guard(m_mutex);
+
+    // stopped in the meantime
+    if (!m_file || size > PACKET_RECORDING_MAX_SIZE)
+        return;
+
+    packet_record record = {
+        .arrival = arrival,
+        .pid = pid,
+        .size = (uint32_t)size,
+    };
+    if (fwrite(&record, sizeof(record), 1, m_file) != 1
+        || fwrite(packet, 1, size, m_file) != size)
+        close();
+}
+
+//---------------------------------------------------------------[ packet_reader
+
+packet_reader::~packet_reader()
+{
+    if (m_file)
+        fclose(m_file);
+}
+
+bool packet_reader::open(const std::string& path)
+{
+    if (m_file)
+        fclose(m_file);
+
+    m_file = fopen(path.c_str(), "rb");
+    if (!m_file)
+        return false;
+
+    packet_recording_header header;
+    if (fread(&header, sizeof(header), 1, m_file) != 1
+        || header.magic != PACKET_RECORDING_MAGIC
+        || header.version != PACKET_RECORDING_VERSION) {
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool packet_reader::next(packet_record& record, std::vector<uint8_t>& packet)
+{
+    if (!m_file || fread(&record, sizeof(record), 1, m_file) != 1
+        || record.size > PACKET_RECORDING_MAX_SIZE)
+        return false;
+
+    packet.resize(record.size);
+    return fread(packet.data(), 1, record.size, m_file) == record.size;
+}
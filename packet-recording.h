@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// clang-format off
+
+#define PACKET_RECORDING_MAGIC          0x52504141 // "AAPR"
+#define PACKET_RECORDING_VERSION        1
+
+// no transport hands over a packet bigger than AUDIO_SHM_SIZE, so a record
+// claiming more is a corrupt recording rather than a big packet
+#define PACKET_RECORDING_MAX_SIZE       (1 << 20)
+
+// clang-format on
+
+// A recording is this header, followed by a packet_record for every packet
+// with the packet itself right after it, exactly as the pipe received it.
+struct packet_recording_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct packet_record {
+    // os_gettime_ns() when the pipe got the packet, same clock as the
+    // timestamp inside it
+    uint64_t arrival;
+    uint32_t pid;
+    uint32_t size;
+};
+
+// Appends packets to a recording from however many threads. While it isn't
+// recording, write() costs one relaxed load. A write that doesn't make it to
+// the file, a full disk say, stops the recording there, so that it never has
+// a torn record in the middle.
+class packet_recorder {
+public:
+    packet_recorder() = default;
+    packet_recorder(const packet_recorder&) = delete;
+    ~packet_recorder();
+
+    packet_recorder& operator=(const packet_recorder&) = delete;
+
+    bool start(const std::string& path);
+    void stop();
+    bool recording() const;
+
+    void write(uint32_t pid, uint64_t arrival, const uint8_t* packet,
+        size_t size);
+
+private:
+    void close();
+
+    std::atomic<bool> m_recording = false;
+    std::mutex m_mutex;
+    FILE* m_file = nullptr;
+};
+
+// Reads a recording back one packet at a time.
+class packet_reader {
+public:
+    packet_reader() = default;
+    packet_reader(const packet_reader&) = delete;
+    ~packet_reader();
+
+    packet_reader& operator=(const packet_reader&) = delete;
+
+    bool open(const std::string& path);
+
+    // Returns false once the recording runs out, a cut-off last packet
+    // included, or at a record bigger than PACKET_RECORDING_MAX_SIZE.
+    bool next(packet_record& record, std::vector<uint8_t>& packet);
+
+private:
+    FILE* m_file = nullptr;
+};
@@ -0,0 +1,389 @@
+#include "shm-transport.h"
+#include "message-ring.h"
+
+#include <chrono>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define SHM_MAGIC 0x4D485341 // "ASHM"
+#define SHM_VERSION 2
+
+struct shm_header {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> closed;
+};
+
+// the ring starts on its own cache line right after the header
+static constexpr size_t SHM_RING_OFFSET = 64;
+
+static uint64_t get_time_ns()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+//--------------------------------------------------------------------[ platform
+
+// A named region of shared memory plus a named wakeup signal. On Windows it's
+// a file mapping and an auto-reset event, elsewhere POSIX shm and an abstract
+// datagram socket, which is only there to run this without Windows. Either
+// way the receiver's end is something the io_loop can wait on.
+struct shm_region {
+    shm_header* header = nullptr;
+    message_ring ring;
+    size_t size = 0;
+    bool owner = false;
+
+#ifdef _WIN32
+    HANDLE mapping = NULL;
+    HANDLE event = NULL;
+#else
+    std::string shm_name;
+    int wake = -1;
+    sockaddr_un wake_address = {};
+    socklen_t wake_address_size = 0;
+#endif
+
+    ~shm_region();
+
+    bool create(uint32_t pid, size_t capacity);
+    bool open(uint32_t pid);
+    void signal();
+
+    // Resets the signal once the receiver has been woken by it.
+    void clear();
+};
+
+#ifdef _WIN32
+
+static std::string object_name(const char* prefix, uint32_t pid)
+{
+    return std::string("Local\\") + prefix + std::to_string(pid);
+}
+
+bool shm_region::create(uint32_t pid, size_t capacity)
+{
+    size = SHM_RING_OFFSET + message_ring::required_size(capacity);
+    owner = true;
+
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((uint64_t)size >> 32), (DWORD)size,
+        object_name(AUDIO_SHM_NAME, pid).c_str());
+    if (!mapping)
+        return false;
+
+    header = (shm_header*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!header)
+        return false;
+
+    event = CreateEventA(NULL, FALSE, FALSE,
+        object_name(AUDIO_SHM_EVENT_NAME, pid).c_str());
+    return event != NULL;
+}
+
+bool shm_region::open(uint32_t pid)
+{
+    mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE,
+        object_name(AUDIO_SHM_NAME, pid).c_str());
+    if (!mapping)
+        return false;
+
+    header = (shm_header*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!header)
+        return false;
+
+    MEMORY_BASIC_INFORMATION info;
+    if (!VirtualQuery(header, &info, sizeof(info)))
+        return false;
+    size = info.RegionSize;
+
+    event = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE,
+        object_name(AUDIO_SHM_EVENT_NAME, pid).c_str());
+    return event != NULL;
+}
+
+shm_region::~shm_region()
+{
+    if (header)
+        UnmapViewOfFile(header);
+    if (mapping)
+        CloseHandle(mapping);
+    if (event)
+        CloseHandle(event);
+}
+
+void shm_region::signal()
+{
+    SetEvent(event);
+}
+
+// auto-reset, so waiting on it already cleared it
+void shm_region::clear()
+{
+}
+
+#else
+
+static std::string object_name(const char* prefix, uint32_t pid)
+{
+    return std::string("/") + prefix + std::to_string(pid);
+}
+
+static sockaddr_un event_address(uint32_t pid, socklen_t& length)
+{
+    std::string name = AUDIO_SHM_EVENT_NAME + std::to_string(pid);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path + 1, name.data(), name.size());
+    length = (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+    return address;
+}
+
+bool shm_region::create(uint32_t pid, size_t capacity)
+{
+    size = SHM_RING_OFFSET + message_ring::required_size(capacity);
+    owner = true;
+    shm_name = object_name(AUDIO_SHM_NAME, pid);
+
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+
+    void* view = ftruncate(fd, (off_t)size) == 0
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+    header = (shm_header*)view;
+
+    wake_address = event_address(pid, wake_address_size);
+    wake = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    return wake >= 0
+        && bind(wake, (sockaddr*)&wake_address, wake_address_size) == 0;
+}
+
+bool shm_region::open(uint32_t pid)
+{
+    int fd = shm_open(object_name(AUDIO_SHM_NAME, pid).c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void* view = fstat(fd, &st) == 0 && st.st_size > (off_t)SHM_RING_OFFSET
+        ? mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+    header = (shm_header*)view;
+    size = (size_t)st.st_size;
+
+    wake_address = event_address(pid, wake_address_size);
+    wake = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    return wake >= 0;
+}
+
+shm_region::~shm_region()
+{
+    if (header)
+        munmap(header, size);
+    if (wake >= 0)
+        close(wake);
+    if (owner)
+        shm_unlink(shm_name.c_str());
+}
+
+// A full queue already means a wakeup is pending, so a failed send is fine.
+void shm_region::signal()
+{
+    char one = 1;
+    sendto(wake, &one, 1, MSG_DONTWAIT | MSG_NOSIGNAL,
+        (sockaddr*)&wake_address, wake_address_size);
+}
+
+void shm_region::clear()
+{
+    char buffer[64];
+    while (recv(wake, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+    }
+}
+
+#endif
+
+//------------------------------------------------------------------[ shm_sender
+
+shm_sender::shm_sender(uint32_t pid)
+    : m_pid(pid)
+{
+}
+
+shm_sender::~shm_sender() = default;
+
+// Opening the region is a couple of syscalls, so it's throttled to
+// RECONNECT_INTERVAL rather than attempted on every send.
+bool shm_sender::connect()
+{
+    if (m_region && !m_region->header->closed.load(std::memory_order_acquire))
+        return true;
+
+    m_region.reset();
+
+    uint64_t now = get_time_ns();
+    if (m_last_connect && now - m_last_connect < RECONNECT_INTERVAL)
+        return false;
+    m_last_connect = now;
+
+    auto region = std::make_unique<shm_region>();
+    if (!region->open(m_pid))
+        return false;
+
+    shm_header* header = region->header;
+    if (header->magic != SHM_MAGIC || header->version != SHM_VERSION
+        || header->closed.load(std::memory_order_acquire))
+        return false;
+
+    if (!region->ring.attach((uint8_t*)header + SHM_RING_OFFSET,
+            region->size - SHM_RING_OFFSET))
+        return false;
+
+    m_region = std::move(region);
+    return true;
+}
+
+bool shm_sender::send(const uint8_t* header, size_t header_size,
+    const uint8_t* data, size_t data_size)
+{
+    if (!connect())
+        return false;
+
+    bool needs_wake = false;
+    if (!m_region->ring.write(header, header_size, data, data_size, needs_wake))
+        return false;
+
+    if (needs_wake)
+        m_region->signal();
+
+    return true;
+}
+
+//----------------------------------------------------------------[ shm_receiver
+
+shm_receiver::shm_receiver(uint32_t pid, callback_t callback, io_loop& loop)
+    : m_callback(std::move(callback))
+    , m_loop(loop)
+{
+    auto region = std::make_unique<shm_region>();
+    if (!region->create(pid, AUDIO_SHM_SIZE))
+        return;
+
+    shm_header* header = region->header;
+    region->ring.init((uint8_t*)header + SHM_RING_OFFSET, AUDIO_SHM_SIZE);
+
+    // nothing can be in the ring yet, this only has the first write wake us
+    region->ring.prepare_sleep();
+
+    // set before add(), which the handler is ordered after
+    m_region = std::move(region);
+    auto handler = [this](void*, size_t, uint32_t) { wake(); };
+
+#ifdef _WIN32
+    m_wait = CreateThreadpoolWait(wait_done, this, NULL);
+    if (m_wait)
+        m_id = m_loop.add(nullptr, std::move(handler));
+    if (!m_id) {
+        if (m_wait)
+            CloseThreadpoolWait(m_wait);
+        m_wait = nullptr;
+        m_region.reset();
+        return;
+    }
+    arm();
+#else
+    m_id = m_loop.add(m_region->wake, std::move(handler));
+    if (!m_id) {
+        m_region.reset();
+        return;
+    }
+#endif
+
+    // only now can a sender attach
+    header->magic = SHM_MAGIC;
+    header->version = SHM_VERSION;
+    header->closed.store(0, std::memory_order_release);
+}
+
+shm_receiver::~shm_receiver()
+{
+    if (!m_region)
+        return;
+
+    // lets a connected sender know to let go of the region
+    m_region->header->closed.store(1, std::memory_order_release);
+
+#ifdef _WIN32
+    // nothing more gets posted once the wait is gone, and whatever already
+    // was is dropped by the io_loop after remove()
+    SetThreadpoolWait(m_wait, NULL, NULL);
+    WaitForThreadpoolWaitCallbacks(m_wait, TRUE);
+    CloseThreadpoolWait(m_wait);
+#endif
+
+    m_loop.remove(m_id);
+}
+
+bool shm_receiver::valid() const
+{
+    return m_region != nullptr;
+}
+
+// Runs on the io_loop's thread. Keeps draining until the ring can be slept on
+// again, so a message written while draining isn't left for the next wakeup.
+void shm_receiver::wake()
+{
+    message_ring& ring = m_region->ring;
+
+    m_region->clear();
+    ring.finish_sleep();
+    do {
+        ring.read(m_callback);
+    } while (!ring.prepare_sleep());
+
+#ifdef _WIN32
+    arm();
+#endif
+}
+
+#ifdef _WIN32
+
+void shm_receiver::arm()
+{
+    int64_t due = -(int64_t)WAIT_TIMEOUT_MS * 10'000;
+    FILETIME timeout = { (DWORD)due, (DWORD)(due >> 32) };
+    SetThreadpoolWait(m_wait, m_region->event, &timeout);
+}
+
+// Signalled or timed out, either way the draining is the io_loop's to do. The
+// receiver itself is the token, it's never handed to the kernel.
+void CALLBACK shm_receiver::wait_done(PTP_CALLBACK_INSTANCE, void* context,
+    PTP_WAIT, TP_WAIT_RESULT)
+{
+    auto receiver = (shm_receiver*)context;
+    receiver->m_loop.post(receiver->m_id, receiver);
+}
+
+#endif
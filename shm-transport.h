@@ -0,0 +1,69 @@
+#pragma once
+#include "audio-transport.h"
+
+#include <memory>
+
+struct shm_region;
+
+#ifdef _WIN32
+struct _TP_CALLBACK_INSTANCE;
+struct _TP_WAIT;
+#endif
+
+// A message_ring in shared memory. The receiver creates the region and the
+// sender opens it, so a sender simply fails until somebody is listening. The
+// receiver hands out pointers straight into the ring without copying.
+class shm_sender : public audio_sender {
+public:
+    shm_sender(uint32_t pid);
+    ~shm_sender() override;
+
+    bool send(const uint8_t* header, size_t header_size,
+        const uint8_t* data, size_t data_size) override;
+
+public:
+    // how long to wait between attempts at opening the region
+    static constexpr uint64_t RECONNECT_INTERVAL = 1'000'000'000;
+
+private:
+    bool connect();
+
+    uint32_t m_pid;
+    std::unique_ptr<shm_region> m_region;
+    uint64_t m_last_connect = 0;
+};
+
+// Drained on the io_loop's thread, like the pipes, so shared memory doesn't
+// cost a thread per process either. The sender's wakeups are what get waited
+// on: on Windows a threadpool wait on the event posts to the io_loop, which
+// re-arms it once the ring is empty again, elsewhere the wakeup is a datagram
+// socket the io_loop polls directly.
+class shm_receiver : public audio_receiver {
+public:
+    shm_receiver(uint32_t pid, callback_t callback, io_loop& loop);
+    ~shm_receiver() override;
+
+    bool valid() const;
+
+public:
+    // upper bound on a wait on Windows, in case a wakeup ever gets lost
+    static constexpr uint32_t WAIT_TIMEOUT_MS = 100;
+
+private:
+    void wake();
+
+#ifdef _WIN32
+    void arm();
+    static void __stdcall wait_done(_TP_CALLBACK_INSTANCE*, void* context,
+        _TP_WAIT*, unsigned long);
+#endif
+
+    callback_t m_callback;
+    io_loop& m_loop;
+    uint64_t m_id = 0;
+    std::unique_ptr<shm_region> m_region;
+
+#ifdef _WIN32
+    _TP_WAIT* m_wait = nullptr;
+#endif
+};
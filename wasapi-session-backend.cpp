@@ -0,0 +1,128 @@
+#include "wasapi-session-backend.h"
+
+#include <Psapi.h>
+#include <Windows.h>
+#include <audioclient.h>
+#include <audiopolicy.h>
+#include <mmdeviceapi.h>
+
+template <typename T> static inline void safe_release(T** out_COM_obj)
+{
+    static_assert(std::is_base_of<IUnknown, T>::value,
+        "Object must implement IUnknown");
+    if (*out_COM_obj)
+        (*out_COM_obj)->Release();
+    *out_COM_obj = nullptr;
+}
+
+// The creation time, which is the cheapest way of telling a reused pid apart
+// from the process it used to be. 0 if the process can't be opened.
+static uint64_t process_start_time(DWORD pid)
+{
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process)
+        return 0;
+
+    uint64_t start_time = 0;
+    FILETIME created, exited, kernel, user;
+    if (GetProcessTimes(process, &created, &exited, &kernel, &user))
+        start_time = ((uint64_t)created.dwHighDateTime << 32)
+            | created.dwLowDateTime;
+
+    CloseHandle(process);
+    return start_time;
+}
+
+bool wasapi_session_backend::enumerate(std::vector<audio_session>& sessions)
+{
+    if (!SUCCEEDED(CoInitialize(NULL)))
+        return false;
+
+    bool success = false;
+    IMMDeviceEnumerator* device_enum = nullptr;
+    IMMDevice* device = nullptr;
+    IAudioSessionManager2* session_manager = nullptr;
+    IAudioSessionEnumerator* session_enum = nullptr;
+    IAudioSessionControl* session_control = nullptr;
+    IAudioSessionControl2* session_control2 = nullptr;
+
+    if (!SUCCEEDED(CoCreateInstance(
+            __uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
+            __uuidof(IMMDeviceEnumerator), (void**)&device_enum)))
+        goto out_uninitialize;
+
+    if (!SUCCEEDED(device_enum->GetDefaultAudioEndpoint(
+            eRender, eMultimedia, &device)))
+        goto out_release_device_enum;
+
+    if (!SUCCEEDED(device->Activate(__uuidof(IAudioSessionManager2), 0,
+            nullptr, (void**)&session_manager)))
+        goto out_release_device;
+
+    if (!SUCCEEDED(session_manager->GetSessionEnumerator(&session_enum)))
+        goto out_release_session_manager;
+
+    int session_count;
+    session_enum->GetCount(&session_count);
+    sessions.reserve(session_count);
+
+    for (int i = 0; i < session_count; i++) {
+        if (!SUCCEEDED(session_enum->GetSession(i, &session_control)))
+            continue;
+
+        if (!SUCCEEDED(session_control->QueryInterface(
+                &session_control2))) {
+            safe_release(&session_control);
+            continue;
+        }
+
+        DWORD pid;
+        session_control2->GetProcessId(&pid);
+
+        wchar_t* display_name = nullptr;
+        session_control->GetDisplayName(&display_name);
+
+        sessions.push_back({ pid, display_name ? display_name : L"",
+            process_start_time(pid) });
+
+        CoTaskMemFree(display_name);
+        safe_release(&session_control2);
+        safe_release(&session_control);
+    }
+    success = true;
+
+    safe_release(&session_enum);
+out_release_session_manager:
+    safe_release(&session_manager);
+out_release_device:
+    safe_release(&device);
+out_release_device_enum:
+    safe_release(&device_enum);
+out_uninitialize:
+    CoUninitialize();
+    return success;
+}
+
+bool wasapi_session_backend::describe(uint32_t pid, std::string& session_name,
+    bool& x64)
+{
+    HANDLE h_process = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ,
+        FALSE, pid);
+    if (!h_process)
+        return false;
+
+    char name[MAX_PATH];
+    DWORD name_len = GetModuleBaseNameA(h_process, NULL, name, MAX_PATH);
+
+    if (name_len > 0) {
+        BOOL x32 = true;
+#ifdef _WIN64
+        IsWow64Process(h_process, &x32);
+#endif
+        session_name.assign(name, name_len);
+        x64 = !x32;
+    }
+
+    CloseHandle(h_process);
+    return name_len > 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "application-manager.h"
+
+// Audio sessions on the default render endpoint, straight from WASAPI.
+class wasapi_session_backend : public session_backend {
+public:
+    bool enumerate(std::vector<audio_session>& sessions) override;
+    bool describe(uint32_t pid, std::string& session_name, bool& x64) override;
+};